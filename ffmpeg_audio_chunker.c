@@ -0,0 +1,250 @@
+#include "ffmpeg_audio_chunker.h"
+
+#include <libavutil/channel_layout.h>
+#include <libavutil/mem.h>
+#include <libavutil/samplefmt.h>
+#include "macrologger.h"
+
+// A compensation is spread over this much output and renewed before it
+// runs out, so small ppm values still move whole samples.
+#define COMP_SECONDS 10
+
+int audio_chunker_init(AudioChunker         *c,
+                       const AVCodecContext *in,
+                       uint64_t              channel_layout,
+                       int                   sample_rate,
+                       enum AVSampleFormat   sample_fmt) {
+  uint64_t in_layout = in->channel_layout ? in->channel_layout : av_get_default_channel_layout(in->channels);
+  int      i;
+  int      ret;
+
+  c->conv           = NULL;
+  c->conv_samples   = 0;
+  c->comp_swr       = NULL;
+  c->comp           = NULL;
+  c->comp_samples   = 0;
+  c->comp_ppm       = 0;
+  c->comp_left      = 0;
+  c->comp_frac      = 0;
+  audio_level_reset(&c->level);
+  c->sample_fmt     = sample_fmt;
+  c->sample_rate    = sample_rate;
+  c->channel_layout = channel_layout;
+  c->channels       = av_get_channel_layout_nb_channels(channel_layout);
+
+  for (i = 0; i < AUDIO_CHUNK_OUTPUTS; i++) {
+    c->fifos[i]    = NULL;
+    c->next_pts[i] = AV_NOPTS_VALUE;
+  }
+
+  c->swr = swr_alloc_set_opts(NULL, channel_layout, sample_fmt, sample_rate,
+                              in_layout, in->sample_fmt, in->sample_rate, 0, NULL);
+
+  if (!c->swr) {
+    LOG_ERROR("Could not alloc resampler");
+    return AVERROR(ENOMEM);
+  }
+
+  if ((ret = swr_init(c->swr)) < 0) {
+    LOG_ERROR("Could not init resampler");
+    audio_chunker_free(c);
+    return ret;
+  }
+
+  for (i = 0; i < AUDIO_CHUNK_OUTPUTS; i++) {
+    c->fifos[i] = av_audio_fifo_alloc(sample_fmt, c->channels, sample_rate / 10);
+
+    if (!c->fifos[i]) {
+      LOG_ERROR("Could not alloc audio fifo");
+      audio_chunker_free(c);
+      return AVERROR(ENOMEM);
+    }
+  }
+  return 0;
+}
+
+void audio_chunker_free(AudioChunker *c) {
+  int i;
+
+  swr_free(&c->swr);
+  swr_free(&c->comp_swr);
+
+  for (i = 0; i < AUDIO_CHUNK_OUTPUTS; i++) {
+    if (c->fifos[i]) av_audio_fifo_free(c->fifos[i]);
+    c->fifos[i] = NULL;
+  }
+  av_freep(&c->conv);
+  av_freep(&c->comp);
+  c->conv_samples = 0;
+  c->comp_samples = 0;
+}
+
+void audio_chunker_reset(AudioChunker *c, int output) {
+  if (!c->fifos[output]) {
+    return;
+  }
+  av_audio_fifo_reset(c->fifos[output]);
+  c->next_pts[output] = AV_NOPTS_VALUE;
+
+  if (output == AUDIO_CHUNK_LIVE) c->comp_frac = 0;
+}
+
+static int apply_compensation(AudioChunker *c) {
+  int distance = c->sample_rate * COMP_SECONDS;
+  int ret      = swr_set_compensation(c->comp_swr, (int)av_rescale(c->comp_ppm, distance, 1000000), distance);
+
+  if (ret < 0) {
+    LOG_ERROR("Could not set compensation");
+    return ret;
+  }
+  c->comp_left = distance;
+  return 0;
+}
+
+int audio_chunker_set_compensation(AudioChunker *c, int ppm) {
+  int ret;
+
+  if (ppm == c->comp_ppm) {
+    return 0;
+  }
+
+  if (!c->swr) {
+    return AVERROR(EINVAL);
+  }
+
+  // Kept once created, dropping it would click.
+  if (!c->comp_swr) {
+    c->comp_swr = swr_alloc_set_opts(NULL, c->channel_layout, c->sample_fmt, c->sample_rate,
+                                     c->channel_layout, c->sample_fmt, c->sample_rate, 0, NULL);
+    if (!c->comp_swr) {
+      LOG_ERROR("Could not alloc compensation resampler");
+      return AVERROR(ENOMEM);
+    }
+
+    if ((ret = swr_init(c->comp_swr)) < 0) {
+      LOG_ERROR("Could not init compensation resampler");
+      swr_free(&c->comp_swr);
+      return ret;
+    }
+  }
+  c->comp_ppm  = ppm;
+  c->comp_frac = 0;
+  return apply_compensation(c);
+}
+
+static int alloc_samples(AudioChunker *c, uint8_t **buff, int *size, int n) {
+  int ret;
+
+  if (n <= *size) {
+    return 0;
+  }
+  av_freep(buff);
+  *size = 0;
+
+  if ((ret = av_samples_alloc(buff, NULL, c->channels, n, c->sample_fmt, 0)) < 0) {
+    LOG_ERROR("Could not alloc converted samples");
+    return ret;
+  }
+  *size = n;
+  return 0;
+}
+
+// Resample n converted samples into comp.
+// return: the samples in comp or error
+static int compensate(AudioChunker *c, int n) {
+  int ret;
+
+  if ((c->comp_left <= 0) && ((ret = apply_compensation(c)) < 0)) {
+    return ret;
+  }
+
+  if ((ret = alloc_samples(c, &c->comp, &c->comp_samples, swr_get_out_samples(c->comp_swr, n))) < 0) {
+    return ret;
+  }
+
+  n = swr_convert(c->comp_swr, &c->comp, c->comp_samples, (const uint8_t **)&c->conv, n);
+  if (n < 0) {
+    LOG_INFO("Could not compensate audio");
+    return n;
+  }
+  c->comp_left -= n;
+  return n;
+}
+
+int audio_chunker_put(AudioChunker *c, const AVFrame *frame, AVRational time_base, int outputs) {
+  int      n = swr_get_out_samples(c->swr, frame->nb_samples);
+  int      i;
+  int      m;
+  uint8_t *data;
+  int      ret;
+
+  if ((ret = alloc_samples(c, &c->conv, &c->conv_samples, n)) < 0) {
+    return ret;
+  }
+
+  n = swr_convert(c->swr, &c->conv, c->conv_samples,
+                  (const uint8_t **)frame->extended_data, frame->nb_samples);
+  if (n < 0) {
+    LOG_INFO("Could not convert audio");
+    return n;
+  }
+
+  if (c->sample_fmt == AV_SAMPLE_FMT_S16) {
+    audio_level_add(&c->level, (const int16_t *)c->conv, n * c->channels);
+  }
+
+  for (i = 0; i < AUDIO_CHUNK_OUTPUTS; i++) {
+    if (!(outputs & (1 << i))) continue;
+
+    data = c->conv;
+    m    = n;
+
+    if ((i == AUDIO_CHUNK_LIVE) && c->comp_swr) {
+      if ((m = compensate(c, n)) < 0) return m;
+      data = c->comp;
+    }
+
+    if ((c->next_pts[i] == AV_NOPTS_VALUE) && (frame->pts != AV_NOPTS_VALUE)) {
+      c->next_pts[i] = av_rescale_q(frame->pts, time_base, av_make_q(1, c->sample_rate)) -
+                       av_audio_fifo_size(c->fifos[i]);
+    }
+
+    if ((ret = av_audio_fifo_write(c->fifos[i], (void **)&data, m)) < m) {
+      LOG_ERROR("Could not write audio fifo");
+      return ret < 0 ? ret : AVERROR(ENOMEM);
+    }
+  }
+  return 0;
+}
+
+int audio_chunker_size(AudioChunker *c, int output) {
+  return c->fifos[output] ? av_audio_fifo_size(c->fifos[output]) : 0;
+}
+
+// Source samples that n samples of output stand for, the stretched live
+// output fewer or more than n, so its pts does not drift off the source.
+static int64_t source_samples(AudioChunker *c, int output, int n) {
+  int64_t scaled;
+
+  if ((output != AUDIO_CHUNK_LIVE) || !c->comp_ppm) {
+    return n;
+  }
+  scaled       = (int64_t)n * 1000000 + c->comp_frac;
+  c->comp_frac = scaled % (1000000 + c->comp_ppm);
+  return scaled / (1000000 + c->comp_ppm);
+}
+
+int audio_chunker_read(AudioChunker *c, int output, uint8_t *buff, int nb_samples, int64_t *pts) {
+  if (audio_chunker_size(c, output) < nb_samples) {
+    return AVERROR(EAGAIN);
+  }
+
+  if (av_audio_fifo_read(c->fifos[output], (void **)&buff, nb_samples) < nb_samples) {
+    return AVERROR(EAGAIN);
+  }
+
+  if (pts) *pts = c->next_pts[output];
+
+  if (c->next_pts[output] != AV_NOPTS_VALUE) c->next_pts[output] += source_samples(c, output, nb_samples);
+  return 0;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // ifdef __cplusplus
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/audio_fifo.h>
+#include <libswresample/swresample.h>
+
+#include "ffmpeg_audio_level.h"
+
+// Outputs of an AudioChunker, each with its own FIFO.
+typedef enum AudioChunkOutput {
+  AUDIO_CHUNK_LIVE, // exact 10ms blocks for delivery
+  AUDIO_CHUNK_REC,  // frames of the encoder frame_size
+  AUDIO_CHUNK_OUTPUTS
+} AudioChunkOutput;
+
+// Converts decoded audio once to a packed output format and slices it into
+// blocks of any size, no sample is dropped. Used on the gang thread only.
+typedef struct AudioChunker {
+  SwrContext         *swr;
+  AVAudioFifo        *fifos[AUDIO_CHUNK_OUTPUTS];
+  int64_t             next_pts[AUDIO_CHUNK_OUTPUTS]; // of the first buffered sample, 1/sample_rate
+  uint8_t            *conv;                          // converted samples of one frame
+  int                 conv_samples;
+  enum AVSampleFormat sample_fmt;
+  int                 sample_rate;
+  int                 channels;
+  uint64_t            channel_layout;
+
+  // every converted sample adds up here in S16, the owner resets it
+  AudioLevel level;
+
+  // live output only, resamples it by comp_ppm against clock drift
+  SwrContext *comp_swr;
+  uint8_t    *comp;
+  int         comp_samples;
+  int         comp_ppm;
+  int         comp_left; // output samples until the compensation runs out
+  int64_t     comp_frac; // remainder of the live pts, in 1/(1000000+comp_ppm) samples
+} AudioChunker;
+
+// Convert from the output of in to channel_layout, sample_rate and the
+// packed sample_fmt.
+// return error
+int  audio_chunker_init(AudioChunker         *c,
+                        const AVCodecContext *in,
+                        uint64_t              channel_layout,
+                        int                   sample_rate,
+                        enum AVSampleFormat   sample_fmt);
+
+void audio_chunker_free(AudioChunker *c);
+
+// Drop the buffered samples of output.
+void audio_chunker_reset(AudioChunker *c,
+                         int           output);
+
+// Convert frame, time_base of its pts, and append it to every output set
+// in the outputs mask, (1 << AUDIO_CHUNK_LIVE) and so on. An empty mask
+// still adds to the level.
+// return error
+int  audio_chunker_put(AudioChunker  *c,
+                       const AVFrame *frame,
+                       AVRational     time_base,
+                       int            outputs);
+
+// Stretch the live output by ppm parts per million, > 0 makes more
+// samples. Takes effect from the next put, the recording is not touched.
+// return error
+int  audio_chunker_set_compensation(AudioChunker *c,
+                                    int           ppm);
+
+// Buffered samples of output.
+int  audio_chunker_size(AudioChunker *c,
+                        int           output);
+
+// Take exactly nb_samples of output into buff, with the pts of the first
+// one, AV_NOPTS_VALUE when not known. The live pts stays in source time
+// while compensated.
+// return: 0->ok, AVERROR(EAGAIN)->not enough buffered
+int  audio_chunker_read(AudioChunker *c,
+                        int           output,
+                        uint8_t      *buff,
+                        int           nb_samples,
+                        int64_t      *pts);
+
+#ifdef __cplusplus
+} // closing brace for extern "C"
+#endif // ifdef __cplusplus
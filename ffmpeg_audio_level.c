@@ -0,0 +1,105 @@
+#include "ffmpeg_audio_level.h"
+
+#include <math.h>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h>
+#endif // if defined(__SSE2__)
+
+// Full scale of the mean square, a square wave at the S16 limits.
+#define FULL_SCALE_SQUARE (32768.0 * 32768.0)
+
+void audio_level_reset(AudioLevel *l) {
+  l->sum_squares = 0;
+  l->samples     = 0;
+  l->peak        = 0;
+}
+
+void audio_level_add(AudioLevel *l, const int16_t *samples, int n) {
+  int64_t sum  = 0;
+  int     peak = l->peak;
+  int     i    = 0;
+
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  __m128i       acc  = zero;
+  __m128i       max  = zero;
+  int16_t       lanes[8];
+  int64_t       sums[2];
+  int           j;
+
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(samples + i));
+
+    // Pairs of squares fit 32 bits unsigned only, widen before adding up.
+    __m128i sq = _mm_madd_epi16(v, v);
+
+    acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+    max = _mm_max_epi16(max, _mm_max_epi16(v, _mm_subs_epi16(zero, v)));
+  }
+  _mm_storeu_si128((__m128i *)sums,  acc);
+  _mm_storeu_si128((__m128i *)lanes, max);
+  sum += sums[0] + sums[1];
+
+  for (j = 0; j < 8; j++) {
+    if (lanes[j] > peak) peak = lanes[j];
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  int64x2_t acc = vdupq_n_s64(0);
+  int16x8_t max = vdupq_n_s16(0);
+  int16_t   lanes[8];
+  int       j;
+
+  for (; i + 8 <= n; i += 8) {
+    int16x8_t v = vld1q_s16(samples + i);
+
+    acc = vpadalq_s32(acc, vmull_s16(vget_low_s16(v), vget_low_s16(v)));
+    acc = vpadalq_s32(acc, vmull_s16(vget_high_s16(v), vget_high_s16(v)));
+    max = vmaxq_s16(max, vqabsq_s16(v));
+  }
+  vst1q_s16(lanes, max);
+  sum += vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1);
+
+  for (j = 0; j < 8; j++) {
+    if (lanes[j] > peak) peak = lanes[j];
+  }
+#endif // if defined(__SSE2__)
+
+  for (; i < n; i++) {
+    int s = samples[i];
+
+    sum += s * s;
+
+    if (s < 0) s = -s;
+
+    if (s > peak) peak = s;
+  }
+  l->sum_squares += sum;
+  l->samples     += n;
+  l->peak         = peak;
+}
+
+static int to_dbfs(double ratio) {
+  double db = ratio > 0 ? 10 * log10(ratio) : AUDIO_LEVEL_FLOOR_DBFS;
+
+  return db < AUDIO_LEVEL_FLOOR_DBFS ? AUDIO_LEVEL_FLOOR_DBFS : (int)lround(db);
+}
+
+int audio_level_rms_dbfs(const AudioLevel *l) {
+  if (!l->samples) {
+    return AUDIO_LEVEL_FLOOR_DBFS;
+  }
+  return to_dbfs(l->sum_squares / (l->samples * FULL_SCALE_SQUARE));
+}
+
+int audio_level_peak_dbfs(const AudioLevel *l) {
+  return to_dbfs((double)l->peak * l->peak / FULL_SCALE_SQUARE);
+}
+
+int audio_level_below(const AudioLevel *l, int dbfs) {
+  // Compared as mean squares, the threshold is a constant per dbfs.
+  return l->sum_squares < l->samples * FULL_SCALE_SQUARE * pow(10, dbfs / 10.0);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // ifdef __cplusplus
+
+#include <stdint.h>
+
+// Level in dBFS of digital silence, the floor of every measure.
+#define AUDIO_LEVEL_FLOOR_DBFS -127
+
+// RMS and peak of interleaved S16 samples, added up over any number of
+// calls. SSE2 or NEON when built for it.
+typedef struct AudioLevel {
+  int64_t sum_squares;
+  int64_t samples;
+  int     peak;
+} AudioLevel;
+
+void audio_level_reset(AudioLevel *l);
+
+void audio_level_add(AudioLevel    *l,
+                     const int16_t *samples,
+                     int            n);
+
+int  audio_level_rms_dbfs(const AudioLevel *l);
+int  audio_level_peak_dbfs(const AudioLevel *l);
+
+// return: 1 when the RMS is under dbfs, no log taken
+int  audio_level_below(const AudioLevel *l,
+                       int               dbfs);
+
+#ifdef __cplusplus
+} // closing brace for extern "C"
+#endif // ifdef __cplusplus
@@ -1,4 +1,5 @@
 #include "ffmpeg_format.h"
+#include "ffmpeg_info_cache.h"
 #include "macrologger.h"
 
 /**
@@ -18,7 +19,7 @@ const char* get_error_text(const int error) {
  * From demuxing_decoding.c
  * return error
  */
-int open_codec_context(int *stream_idx, AVFormatContext **i_fctx, enum AVMediaType type) {
+int open_codec_context(int *stream_idx, AVFormatContext **i_fctx, enum AVMediaType type, int threads, int frame_threads) {
   int             ret, stream_index;
   AVStream       *st;
   AVCodecContext *dec_ctx = NULL;
@@ -44,6 +45,11 @@ int open_codec_context(int *stream_idx, AVFormatContext **i_fctx, enum AVMediaTy
       return AVERROR(EINVAL);
     }
 
+    if (type == AVMEDIA_TYPE_VIDEO) {
+      dec_ctx->thread_count = threads;
+      dec_ctx->thread_type  = frame_threads ? FF_THREAD_FRAME | FF_THREAD_SLICE : FF_THREAD_SLICE;
+    }
+
     if ((ret = avcodec_open2(dec_ctx, dec, NULL)) < 0) {
       LOG_INFO("Failed to open %s codec", av_get_media_type_string(type));
       return ret;
@@ -54,19 +60,29 @@ int open_codec_context(int *stream_idx, AVFormatContext **i_fctx, enum AVMediaTy
   return 0;
 }
 
+// A cached entry only needs a short probe to confirm the streams.
+#define INFO_CACHE_PROBESIZE        32768
+#define INFO_CACHE_ANALYZE_DURATION 500000
+
 /**
- * From transcode_aac.c
- * Open an input file and the required decoder.
- * Need close stream if only get basic stream info but not use it.
+ * Open the input and find its stream info, shortcut by the stream info cache.
  * return error
  */
-int open_input_file(
-  const char       *filename,
-  AVFormatContext **i_fctx,
-  AVStream        **video_stream,
-  AVStream        **audio_stream,
-  int               audio_off) {
-  int error, video_stream_idx, audio_stream_idx;
+static int probe_input(const char            *filename,
+                       AVFormatContext      **i_fctx,
+                       const AVIOInterruptCB *int_cb,
+                       int                    use_cache) {
+  StreamInfoCache cache;
+  int             error, cached = 0;
+
+  // The callback has to be in place before avformat_open_input connects.
+  if (int_cb) {
+    if (!(*i_fctx = avformat_alloc_context())) {
+      LOG_ERROR("Could not allocate input context");
+      return AVERROR(ENOMEM);
+    }
+    (*i_fctx)->interrupt_callback = *int_cb;
+  }
 
   /** Open the input file to read from it. */
   if ((error = avformat_open_input(i_fctx, filename, NULL, NULL)) < 0) {
@@ -75,19 +91,66 @@ int open_input_file(
     return error;
   }
 
+  if (use_cache && info_cache_load(filename, &cache)) {
+    cached = info_cache_apply(&cache, *i_fctx);
+
+    if (cached) {
+      (*i_fctx)->probesize            = INFO_CACHE_PROBESIZE;
+      (*i_fctx)->max_analyze_duration = INFO_CACHE_ANALYZE_DURATION;
+    }
+  }
+
   /** Get information on the input file (number of streams etc.). */
-  if ((error = avformat_find_stream_info(*i_fctx, NULL)) < 0) {
+  error = avformat_find_stream_info(*i_fctx, NULL);
+
+  if (cached && ((error < 0) || !info_cache_match(&cache, *i_fctx))) {
+    LOG_INFO("Stream info cache of '%s' is stale, probe again", filename);
+    info_cache_free(&cache);
+    info_cache_remove(filename);
+    avformat_close_input(i_fctx);
+    return probe_input(filename, i_fctx, int_cb, 0);
+  }
+
+  if (use_cache) info_cache_free(&cache);
+
+  if (error < 0) {
     LOG_INFO("Could not open find stream info (error '%s')", get_error_text(error));
     avformat_close_input(i_fctx);
     return error;
   }
 
+  if (!cached) info_cache_save(filename, *i_fctx);
+  return 0;
+}
+
+/**
+ * From transcode_aac.c
+ * Open an input file and the required decoder.
+ * Need close stream if only get basic stream info but not use it.
+ * int_cb, when given, interrupts blocking I/O from the open on.
+ * return error
+ */
+int open_input_file(
+  const char            *filename,
+  AVFormatContext      **i_fctx,
+  AVStream             **video_stream,
+  AVStream             **audio_stream,
+  int                    audio_off,
+  int                    video_threads,
+  int                    video_frame_threads,
+  const AVIOInterruptCB *int_cb) {
+  int error, video_stream_idx, audio_stream_idx;
+
+  if ((error = probe_input(filename, i_fctx, int_cb, 1)) < 0) {
+    return error;
+  }
+
   // From demuxing_decoding.c
-  if (open_codec_context(&video_stream_idx, i_fctx, AVMEDIA_TYPE_VIDEO) >= 0) {
+  if (open_codec_context(&video_stream_idx, i_fctx, AVMEDIA_TYPE_VIDEO, video_threads, video_frame_threads) >= 0) {
     *video_stream = (*i_fctx)->streams[video_stream_idx];
   }
 
-  if (!audio_off && (open_codec_context(&audio_stream_idx, i_fctx, AVMEDIA_TYPE_AUDIO) >= 0)) {
+  if (!audio_off && (open_codec_context(&audio_stream_idx, i_fctx, AVMEDIA_TYPE_AUDIO, 1, 0) >= 0)) {
     *audio_stream = (*i_fctx)->streams[audio_stream_idx];
   }
 
@@ -16,23 +16,31 @@ const char* get_error_text(const int error);
 
 /**
  * From demuxing_decoding.c
+ * threads of a video decoder, slice threaded, 0 for auto. frame_threads
+ * adds frame threading, which delays output by threads-1 frames.
  * return error
  */
 int         open_codec_context(
   int             *stream_idx,
   AVFormatContext *(*input_format_context),
-  enum AVMediaType type);
+  enum AVMediaType type,
+  int              threads,
+  int              frame_threads);
 
 /**
  * From transcode_aac.c
  * Open an input file and the required decoder.
+ * int_cb, when given, interrupts blocking I/O from the open on.
  */
 int open_input_file(
-  const char       *filename,
-  AVFormatContext **input_format_context,
-  AVStream        **video_stream,
-  AVStream        **audio_stream,
-  int               audio_off);
+  const char            *filename,
+  AVFormatContext      **input_format_context,
+  AVStream             **video_stream,
+  AVStream             **audio_stream,
+  int                    audio_off,
+  int                    video_threads,
+  int                    video_frame_threads,
+  const AVIOInterruptCB *int_cb);
 
 /** Initialize one audio frame for reading from the input file */
 int init_frame(AVFrame **frame);
@@ -0,0 +1,83 @@
+#include "ffmpeg_gop_cache.h"
+
+#include <libavutil/mem.h>
+#include "macrologger.h"
+
+int gop_cache_init(GopCache *c, int max_pkts, int key_stream) {
+  c->pkts       = NULL;
+  c->size       = 0;
+  c->capacity   = 0;
+  c->max_pkts   = max_pkts;
+  c->key_stream = key_stream;
+  c->valid      = 0;
+  return 0;
+}
+
+void gop_cache_free(GopCache *c) {
+  gop_cache_reset(c);
+  av_freep(&c->pkts);
+  c->capacity = 0;
+}
+
+void gop_cache_reset(GopCache *c) {
+  int i;
+
+  for (i = 0; i < c->size; i++) {
+    av_packet_unref(&c->pkts[i]);
+  }
+  c->size  = 0;
+  c->valid = 0;
+}
+
+static int grow(GopCache *c) {
+  int       capacity = c->capacity ? c->capacity * 2 : 64;
+  AVPacket *pkts;
+
+  if (capacity > c->max_pkts) capacity = c->max_pkts;
+
+  pkts = av_realloc_array(c->pkts, capacity, sizeof(*pkts));
+  if (!pkts) {
+    LOG_ERROR("Could not grow gop cache");
+    return AVERROR(ENOMEM);
+  }
+  c->pkts     = pkts;
+  c->capacity = capacity;
+  return 0;
+}
+
+int gop_cache_put(GopCache *c, const AVPacket *pkt) {
+  int ret;
+
+  if ((c->key_stream < 0) || (c->max_pkts <= 0)) {
+    return 0;
+  }
+
+  if ((pkt->stream_index == c->key_stream) && (pkt->flags & AV_PKT_FLAG_KEY)) {
+    gop_cache_reset(c);
+    c->valid = 1;
+  }
+
+  if (!c->valid) {
+    return 0;
+  }
+
+  if (c->size == c->max_pkts) {
+    // Too long to replay, wait for the next keyframe.
+    gop_cache_reset(c);
+    return 0;
+  }
+
+  if ((c->size == c->capacity) && ((ret = grow(c)) < 0)) {
+    gop_cache_reset(c);
+    return ret;
+  }
+
+  av_init_packet(&c->pkts[c->size]);
+  ret = av_packet_ref(&c->pkts[c->size], pkt);
+  if (ret < 0) {
+    gop_cache_reset(c);
+    return ret;
+  }
+  c->size++;
+  return 0;
+}
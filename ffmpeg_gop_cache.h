@@ -0,0 +1,38 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // ifdef __cplusplus
+
+#include <libavcodec/avcodec.h>
+
+// Refs of all packets read since the last keyframe of key_stream, in read
+// order. Used on the gang thread only.
+typedef struct GopCache {
+  AVPacket *pkts;
+  int       size;
+  int       capacity;
+  int       max_pkts;   // longer GOPs are not cached
+  int       key_stream;
+  int       valid;      // pkts[0] is a keyframe of key_stream
+} GopCache;
+
+// return error
+int  gop_cache_init(GopCache *c,
+                    int       max_pkts,
+                    int       key_stream);
+
+void gop_cache_free(GopCache *c);
+
+// Unref all cached packets.
+void gop_cache_reset(GopCache *c);
+
+// A keyframe of key_stream starts a new GOP. Packets are only cached after
+// the first keyframe.
+// return error
+int  gop_cache_put(GopCache       *c,
+                   const AVPacket *pkt);
+
+#ifdef __cplusplus
+} // closing brace for extern "C"
+#endif // ifdef __cplusplus
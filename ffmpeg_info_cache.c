@@ -0,0 +1,259 @@
+#include "ffmpeg_info_cache.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <libavutil/base64.h>
+#include <libavutil/mem.h>
+#include "macrologger.h"
+
+#define INFO_CACHE_MAGIC "gang-stream-info"
+#define INFO_CACHE_LINE_SIZE 16384
+
+static char *cache_dir = NULL;
+
+void set_stream_info_cache_dir(const char *dir) {
+  av_freep(&cache_dir);
+
+  if (dir && *dir) cache_dir = av_strdup(dir);
+}
+
+const char* get_stream_info_cache_dir() {
+  return cache_dir;
+}
+
+// FNV-1a, the url itself is stored in the file to rule out collisions.
+static void cache_path(char *path, size_t size, const char *url) {
+  uint64_t    hash = 14695981039346656037ULL;
+  const char *p;
+
+  for (p = url; *p; p++) {
+    hash ^= (uint8_t)*p;
+    hash *= 1099511628211ULL;
+  }
+  snprintf(path, size, "%s/%016" PRIx64 ".info", cache_dir, hash);
+}
+
+static void strip_newline(char *line) {
+  size_t len = strlen(line);
+
+  while (len && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+}
+
+void info_cache_free(StreamInfoCache *cache) {
+  unsigned int i;
+
+  for (i = 0; i < cache->nb_streams; i++) {
+    av_freep(&cache->streams[i].extradata);
+  }
+  cache->nb_streams = 0;
+}
+
+// b64 holds INFO_CACHE_LINE_SIZE bytes.
+static int parse_stream(const char *line, char *b64, CachedStreamInfo *info) {
+  int codec_type, codec_id, pix_fmt, sample_fmt;
+  int size;
+
+  if (sscanf(line, "stream %d %d %d %d %d %d %d %d %" SCNu64 " %d %d %16383s",
+             &codec_type, &codec_id, &info->width, &info->height, &pix_fmt,
+             &info->sample_rate, &info->channels, &sample_fmt, &info->channel_layout,
+             &info->frame_rate.num, &info->frame_rate.den, b64) != 12) {
+    return 0;
+  }
+  info->codec_type = codec_type;
+  info->codec_id   = codec_id;
+  info->pix_fmt    = pix_fmt;
+  info->sample_fmt = sample_fmt;
+
+  if (!strcmp(b64, "-")) {
+    return 1;
+  }
+  size            = strlen(b64) * 3 / 4 + 1;
+  info->extradata = av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE);
+
+  if (!info->extradata) {
+    return 0;
+  }
+  info->extradata_size = av_base64_decode(info->extradata, b64, size);
+  return info->extradata_size >= 0;
+}
+
+// Decoders of many urls load at once, so the buffers are per call.
+int info_cache_load(const char *url, StreamInfoCache *cache) {
+  char        *line = NULL;
+  char        *b64  = NULL;
+  char         path[1024];
+  FILE        *f;
+  int          version;
+  unsigned int i;
+
+  memset(cache, 0, sizeof(*cache));
+
+  if (!cache_dir) {
+    return 0;
+  }
+  cache_path(path, sizeof(path), url);
+
+  if (!(f = fopen(path, "r"))) {
+    return 0;
+  }
+  line = av_malloc(INFO_CACHE_LINE_SIZE);
+  b64  = av_malloc(INFO_CACHE_LINE_SIZE);
+
+  if (!line || !b64) goto fail;
+
+  if (!fgets(line, INFO_CACHE_LINE_SIZE, f) ||
+      (sscanf(line, INFO_CACHE_MAGIC " %d", &version) != 1) ||
+      (version != LIBAVCODEC_VERSION_INT)) goto fail;
+
+  if (!fgets(line, INFO_CACHE_LINE_SIZE, f) || strncmp(line, "url ", 4)) goto fail;
+  strip_newline(line);
+
+  if (strcmp(line + 4, url)) goto fail;
+
+  if (!fgets(line, INFO_CACHE_LINE_SIZE, f) ||
+      (sscanf(line, "streams %u", &cache->nb_streams) != 1) ||
+      (cache->nb_streams > INFO_CACHE_MAX_STREAMS)) {
+    cache->nb_streams = 0;
+    goto fail;
+  }
+
+  for (i = 0; i < cache->nb_streams; i++) {
+    if (!fgets(line, INFO_CACHE_LINE_SIZE, f) || !parse_stream(line, b64, &cache->streams[i])) goto fail;
+  }
+  fclose(f);
+  av_free(line);
+  av_free(b64);
+  LOG_DEBUG("Stream info of '%s' loaded from cache", url);
+  return 1;
+
+fail: fclose(f);
+  av_free(line);
+  av_free(b64);
+  LOG_INFO("Ignore broken stream info cache '%s'", path);
+  info_cache_free(cache);
+  return 0;
+}
+
+int info_cache_apply(const StreamInfoCache *cache, AVFormatContext *ic) {
+  const CachedStreamInfo *info;
+  AVCodecContext         *c;
+  unsigned int            i;
+
+  if (cache->nb_streams != ic->nb_streams) {
+    return 0;
+  }
+
+  for (i = 0; i < ic->nb_streams; i++) {
+    c = ic->streams[i]->codec;
+
+    if ((c->codec_type != cache->streams[i].codec_type) ||
+        (c->codec_id != cache->streams[i].codec_id)) return 0;
+  }
+
+  for (i = 0; i < ic->nb_streams; i++) {
+    info = &cache->streams[i];
+    c    = ic->streams[i]->codec;
+
+    c->width                  = info->width;
+    c->height                 = info->height;
+    c->pix_fmt                = info->pix_fmt;
+    c->sample_rate            = info->sample_rate;
+    c->channels               = info->channels;
+    c->sample_fmt             = info->sample_fmt;
+    c->channel_layout         = info->channel_layout;
+    ic->streams[i]->r_frame_rate = info->frame_rate;
+
+    if (!c->extradata_size && info->extradata_size) {
+      c->extradata = av_mallocz(info->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+
+      if (!c->extradata) return 0;
+      memcpy(c->extradata, info->extradata, info->extradata_size);
+      c->extradata_size = info->extradata_size;
+    }
+  }
+  return 1;
+}
+
+int info_cache_match(const StreamInfoCache *cache, AVFormatContext *ic) {
+  const CachedStreamInfo *info;
+  AVCodecContext         *c;
+  unsigned int            i;
+
+  if (cache->nb_streams != ic->nb_streams) {
+    return 0;
+  }
+
+  for (i = 0; i < ic->nb_streams; i++) {
+    info = &cache->streams[i];
+    c    = ic->streams[i]->codec;
+
+    if ((c->codec_id != info->codec_id) ||
+        (c->width != info->width) ||
+        (c->height != info->height) ||
+        (c->sample_rate != info->sample_rate) ||
+        (c->channels != info->channels)) return 0;
+  }
+  return 1;
+}
+
+void info_cache_save(const char *url, AVFormatContext *ic) {
+  char            path[1024];
+  char            tmp[1100];
+  char           *b64;
+  int             b64_size;
+  FILE           *f;
+  AVStream       *st;
+  AVCodecContext *c;
+  unsigned int    i;
+
+  if (!cache_dir || (ic->nb_streams > INFO_CACHE_MAX_STREAMS)) {
+    return;
+  }
+  cache_path(path, sizeof(path), url);
+
+  // Write aside and rename, a reader never sees half a file.
+  snprintf(tmp, sizeof(tmp), "%s.%p.tmp", path, (void *)ic);
+
+  if (!(f = fopen(tmp, "w"))) {
+    LOG_INFO("Could not write stream info cache '%s'", tmp);
+    return;
+  }
+  fprintf(f, INFO_CACHE_MAGIC " %d\n", LIBAVCODEC_VERSION_INT);
+  fprintf(f, "url %s\n", url);
+  fprintf(f, "streams %u\n", ic->nb_streams);
+
+  for (i = 0; i < ic->nb_streams; i++) {
+    st  = ic->streams[i];
+    c   = st->codec;
+    b64 = NULL;
+
+    if (c->extradata_size) {
+      b64_size = AV_BASE64_SIZE(c->extradata_size);
+
+      if (b64_size < INFO_CACHE_LINE_SIZE / 2) b64 = av_malloc(b64_size);
+
+      if (b64) av_base64_encode(b64, b64_size, c->extradata, c->extradata_size);
+    }
+    fprintf(f, "stream %d %d %d %d %d %d %d %d %" PRIu64 " %d %d %s\n",
+            c->codec_type, c->codec_id, c->width, c->height, c->pix_fmt,
+            c->sample_rate, c->channels, c->sample_fmt, c->channel_layout,
+            st->r_frame_rate.num, st->r_frame_rate.den, b64 ? b64 : "-");
+    av_free(b64);
+  }
+
+  if (fclose(f) || rename(tmp, path)) {
+    LOG_INFO("Could not save stream info cache '%s'", path);
+    remove(tmp);
+  }
+}
+
+void info_cache_remove(const char *url) {
+  char path[1024];
+
+  if (!cache_dir) {
+    return;
+  }
+  cache_path(path, sizeof(path), url);
+  remove(path);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // ifdef __cplusplus
+
+#include <libavformat/avformat.h>
+
+#define INFO_CACHE_MAX_STREAMS 8
+
+// What avformat_find_stream_info finds out about one stream.
+typedef struct CachedStreamInfo {
+  enum AVMediaType    codec_type;
+  enum AVCodecID      codec_id;
+  int                 width;
+  int                 height;
+  enum AVPixelFormat  pix_fmt;
+  int                 sample_rate;
+  int                 channels;
+  enum AVSampleFormat sample_fmt;
+  uint64_t            channel_layout;
+  AVRational          frame_rate;
+  uint8_t            *extradata;
+  int                 extradata_size;
+} CachedStreamInfo;
+
+typedef struct StreamInfoCache {
+  unsigned int     nb_streams;
+  CachedStreamInfo streams[INFO_CACHE_MAX_STREAMS];
+} StreamInfoCache;
+
+// Directory of the on-disk cache, one file per url. NULL disables it.
+// Set it once before any input is opened.
+void        set_stream_info_cache_dir(const char *dir);
+const char* get_stream_info_cache_dir();
+
+// return: 1->loaded, 0->no usable entry
+int         info_cache_load(const char      *url,
+                            StreamInfoCache *cache);
+
+// Copy the cached parameters into the streams opened by
+// avformat_open_input, so a short probe is enough.
+// return: 1->applied, 0->the streams do not match the cache
+int         info_cache_apply(const StreamInfoCache *cache,
+                             AVFormatContext       *ic);
+
+// return: 1->the probed streams still match the cache, 0->they differ
+int         info_cache_match(const StreamInfoCache *cache,
+                             AVFormatContext       *ic);
+
+// Write the probed streams of ic as the entry of url.
+void        info_cache_save(const char      *url,
+                            AVFormatContext *ic);
+
+void        info_cache_remove(const char *url);
+
+void        info_cache_free(StreamInfoCache *cache);
+
+#ifdef __cplusplus
+} // closing brace for extern "C"
+#endif // ifdef __cplusplus
@@ -0,0 +1,205 @@
+#include "ffmpeg_packet_queue.h"
+
+#include <errno.h>
+#include <time.h>
+#include <libavutil/mem.h>
+#include "macrologger.h"
+
+// The waiting flags and the indexes form a store-load handshake between the
+// two sides, so keep every access sequentially consistent.
+#define PQ_LOAD(p)     __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define PQ_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+
+static void deadline_after(struct timespec *ts, int ms) {
+  clock_gettime(CLOCK_REALTIME, ts);
+  ts->tv_sec  += ms / 1000;
+  ts->tv_nsec += (long)(ms % 1000) * 1000000;
+
+  if (ts->tv_nsec >= 1000000000) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000;
+  }
+}
+
+int packet_queue_init(PacketQueue *q, unsigned capacity, int policy, int key_stream) {
+  unsigned i;
+
+  if (!capacity) {
+    return AVERROR(EINVAL);
+  }
+
+  q->pkts = av_malloc_array(capacity, sizeof(*q->pkts));
+  if (!q->pkts) {
+    LOG_ERROR("Could not malloc packet queue");
+    return AVERROR(ENOMEM);
+  }
+
+  for (i = 0; i < capacity; i++) {
+    av_init_packet(&q->pkts[i]);
+    q->pkts[i].data = NULL;
+    q->pkts[i].size = 0;
+  }
+  q->capacity      = capacity;
+  q->head          = 0;
+  q->tail          = 0;
+  q->policy        = policy;
+  q->key_stream    = key_stream;
+  q->dropping      = 0;
+  q->dropped       = 0;
+  q->eof           = 0;
+  q->abort         = 0;
+  q->get_waiting   = 0;
+  q->put_waiting   = 0;
+  q->notify        = NULL;
+  q->notify_opaque = NULL;
+  q->armed         = 0;
+  sem_init(&q->get_sem, 0, 0);
+  sem_init(&q->put_sem, 0, 0);
+  return 0;
+}
+
+void packet_queue_destroy(PacketQueue *q) {
+  unsigned i;
+
+  if (!q->pkts) {
+    return;
+  }
+
+  for (i = 0; i < q->capacity; i++) {
+    av_packet_unref(&q->pkts[i]);
+  }
+  av_freep(&q->pkts);
+  sem_destroy(&q->get_sem);
+  sem_destroy(&q->put_sem);
+  q->capacity = 0;
+  q->head     = 0;
+  q->tail     = 0;
+}
+
+// Producer. Only one side takes an armed flag, so notify runs once.
+static void notify_consumer(PacketQueue *q) {
+  if (__atomic_exchange_n(&q->armed, 0, __ATOMIC_SEQ_CST)) q->notify(q->notify_opaque);
+}
+
+static int drop_packet(PacketQueue *q, AVPacket *pkt) {
+  av_packet_unref(pkt);
+  __atomic_add_fetch(&q->dropped, 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+int packet_queue_put(PacketQueue *q, AVPacket *pkt) {
+  unsigned head = q->head;
+  int      ret;
+
+  if (q->dropping && (pkt->stream_index == q->key_stream)) {
+    if (!(pkt->flags & AV_PKT_FLAG_KEY)) return drop_packet(q, pkt);
+    q->dropping = 0;
+  }
+
+  while (head - PQ_LOAD(&q->tail) >= q->capacity) {
+    if (PQ_LOAD(&q->abort)) {
+      av_packet_unref(pkt);
+      return AVERROR_EXIT;
+    }
+
+    if (q->policy == PKT_QUEUE_DROP) {
+      // Other streams lose only this packet, nothing refers to it.
+      if (pkt->stream_index == q->key_stream) q->dropping = 1;
+      return drop_packet(q, pkt);
+    }
+
+    PQ_STORE(&q->put_waiting, 1);
+
+    if ((head - PQ_LOAD(&q->tail) >= q->capacity) && !PQ_LOAD(&q->abort)) {
+      sem_wait(&q->put_sem);
+    }
+    PQ_STORE(&q->put_waiting, 0);
+  }
+
+  // Demuxers may return packets that are only valid until the next read,
+  // av_packet_ref makes a refcounted copy of those.
+  ret = av_packet_ref(&q->pkts[head % q->capacity], pkt);
+  av_packet_unref(pkt);
+
+  if (ret < 0) {
+    LOG_ERROR("Could not ref packet into queue");
+    return ret;
+  }
+  PQ_STORE(&q->head, head + 1);
+
+  if (PQ_LOAD(&q->get_waiting)) sem_post(&q->get_sem);
+  notify_consumer(q);
+  return 0;
+}
+
+int packet_queue_get(PacketQueue *q, AVPacket *pkt, int timeout_ms) {
+  unsigned        tail = q->tail;
+  struct timespec deadline;
+  int             waited = 0;
+  int             err;
+
+  while (PQ_LOAD(&q->head) == tail) {
+    if (PQ_LOAD(&q->abort)) return AVERROR_EXIT;
+
+    err = PQ_LOAD(&q->eof);
+    if (err) {
+      // Packets put before eof must still be consumed.
+      if (PQ_LOAD(&q->head) != tail) break;
+      return err;
+    }
+
+    if (waited || !timeout_ms) return AVERROR(EAGAIN);
+
+    deadline_after(&deadline, timeout_ms);
+    PQ_STORE(&q->get_waiting, 1);
+
+    if ((PQ_LOAD(&q->head) == tail) && !PQ_LOAD(&q->eof) && !PQ_LOAD(&q->abort)) {
+      while (sem_timedwait(&q->get_sem, &deadline) && (errno == EINTR)) {}
+    }
+    PQ_STORE(&q->get_waiting, 0);
+    waited = 1;
+  }
+
+  av_packet_move_ref(pkt, &q->pkts[tail % q->capacity]);
+  PQ_STORE(&q->tail, tail + 1);
+
+  if (PQ_LOAD(&q->put_waiting)) sem_post(&q->put_sem);
+  return 0;
+}
+
+void packet_queue_set_eof(PacketQueue *q, int err) {
+  PQ_STORE(&q->eof, err < 0 ? err : AVERROR_EOF);
+
+  if (PQ_LOAD(&q->get_waiting)) sem_post(&q->get_sem);
+  notify_consumer(q);
+}
+
+int packet_queue_arm(PacketQueue *q, PacketQueueNotify notify, void *opaque) {
+  q->notify        = notify;
+  q->notify_opaque = opaque;
+  PQ_STORE(&q->armed, 1);
+
+  if ((PQ_LOAD(&q->head) == q->tail) && !PQ_LOAD(&q->eof) && !PQ_LOAD(&q->abort)) {
+    return 1;
+  }
+
+  // Already taken when the producer got there first, then notify comes.
+  return !__atomic_exchange_n(&q->armed, 0, __ATOMIC_SEQ_CST);
+}
+
+void packet_queue_abort(PacketQueue *q) {
+  PQ_STORE(&q->abort, 1);
+  sem_post(&q->get_sem);
+  sem_post(&q->put_sem);
+}
+
+unsigned packet_queue_occupancy(PacketQueue *q) {
+  if (!q->pkts) {
+    return 0;
+  }
+  return PQ_LOAD(&q->head) - PQ_LOAD(&q->tail);
+}
+
+int64_t packet_queue_dropped(PacketQueue *q) {
+  return __atomic_load_n(&q->dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif // ifdef __cplusplus
+
+#include <semaphore.h>
+#include <libavcodec/avcodec.h>
+
+// What the reader does when the queue is full.
+typedef enum PacketQueuePolicy {
+  // Wait for a free slot, backing up the input like inline reading does.
+  PKT_QUEUE_BLOCK,
+
+  // Drop the incoming packet. When it is of key_stream, then every packet of
+  // it until its next keyframe so the decoder never sees a broken reference
+  // chain.
+  PKT_QUEUE_DROP
+} PacketQueuePolicy;
+
+// Called by the producer for a consumer that armed the queue.
+typedef void (*PacketQueueNotify)(void *opaque);
+
+// Bounded lock-free single-producer/single-consumer packet ring.
+// The reader thread is the only producer, the gang thread the only consumer.
+// The semaphores are only used to sleep when the ring is empty or full, a
+// consumer without a thread of its own arms notify instead.
+typedef struct PacketQueue {
+  AVPacket *pkts;
+  unsigned  capacity;
+  unsigned  head;       // next slot to put, written by producer only
+  unsigned  tail;       // next slot to get, written by consumer only
+  int       policy;
+  int       key_stream; // stream index that must restart on a keyframe
+  int       dropping;   // producer only
+  int64_t   dropped;
+  int       eof;        // read error from producer, 0 while running
+  int       abort;
+  int       get_waiting;
+  int       put_waiting;
+  sem_t     get_sem;
+  sem_t     put_sem;
+
+  PacketQueueNotify notify;
+  void             *notify_opaque;
+  int               armed;
+} PacketQueue;
+
+// return error
+int      packet_queue_init(PacketQueue *q,
+                           unsigned     capacity,
+                           int          policy,
+                           int          key_stream);
+
+// Unref all left packets and free the ring.
+void     packet_queue_destroy(PacketQueue *q);
+
+// Producer. A ref of pkt is queued, pkt itself is always unrefed.
+// return: 0->queued, 1->dropped, <0->aborted
+int      packet_queue_put(PacketQueue *q,
+                          AVPacket    *pkt);
+
+// Consumer. Wait at most timeout_ms for a packet and move it into pkt.
+// return: 0->got, AVERROR(EAGAIN)->timeout, <0->eof or read error
+int      packet_queue_get(PacketQueue *q,
+                          AVPacket    *pkt,
+                          int          timeout_ms);
+
+// Producer. Record why reading stopped, consumer gets it after the last
+// queued packet.
+void     packet_queue_set_eof(PacketQueue *q,
+                              int          err);
+
+// Consumer. Have notify called once by the producer after its next put or
+// eof, instead of waiting in packet_queue_get.
+// return: 1->armed, 0->a packet or eof is already there, get it now
+int      packet_queue_arm(PacketQueue      *q,
+                          PacketQueueNotify notify,
+                          void             *opaque);
+
+// Wake up both sides and make them return.
+void     packet_queue_abort(PacketQueue *q);
+
+// Can be called from any thread.
+unsigned packet_queue_occupancy(PacketQueue *q);
+int64_t  packet_queue_dropped(PacketQueue *q);
+
+#ifdef __cplusplus
+} // closing brace for extern "C"
+#endif // ifdef __cplusplus
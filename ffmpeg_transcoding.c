@@ -27,6 +27,7 @@
 
 #include <libavformat/avio.h>
 #include <libavutil/channel_layout.h>
+#include <libavutil/dict.h>
 #include <libavutil/mem.h>
 #include <libavutil/opt.h>
 #include <libavutil/samplefmt.h>
@@ -53,6 +54,31 @@ static int normalize_opus_rate(int r) {
          48000 : (r >= 24000 ? 24000 : (r >= 16000 ? 16000 : (r >= 12000 ? 12000 : 8000)));
 }
 
+// Fill the filtered output format and filter_spec of fsc.
+// Audio has no filter graph, the AudioChunker of the decoder converts it.
+// Require is
+static void init_output_format(FilterStreamContext *fsc) {
+  AVCodecContext *i_dec_ctx = fsc->is->codec;
+
+  if (fsc->is_video) {
+    /* take first format from list of supported formats */
+    fsc->pix_fmt = AV_PIX_FMT_YUV420P;
+    fsc->width   = i_dec_ctx->width;
+    fsc->height  = i_dec_ctx->height;
+
+    // TODO add spec to fit in.
+    fsc->filter_spec = av_strdup("null");
+  } else {
+    fsc->channels       = i_dec_ctx->channels > 2 ? 2 : i_dec_ctx->channels;
+    fsc->channel_layout = av_get_default_channel_layout(fsc->channels);
+    fsc->sample_rate    = normalize_opus_rate(i_dec_ctx->sample_rate);
+
+    /* take first format from list of supported formats */
+    fsc->sample_fmt  = AV_SAMPLE_FMT_S16;
+    fsc->filter_spec = NULL;
+  }
+}
+
 int open_input_streams(gang_decoder *dec) {
   FilterStreamContext *fs_ctx      = NULL;
   AVStream            *i_v_s       = NULL;
@@ -61,7 +87,7 @@ int open_input_streams(gang_decoder *dec) {
   unsigned int         i           = 0;
   int                  ret;
 
-  if ((ret = open_input_file(dec->url, &dec->ifmt_ctx, &i_v_s, &i_a_s, dec->audio_off)) < 0) return ret;
+  if ((ret = open_input_file(dec->url, &dec->ifmt_ctx, &i_v_s, &i_a_s, dec->audio_off, dec->video_threads, dec->video_frame_threads, &dec->io_cb)) < 0) return ret;
 
   if (i_v_s) stream_size++;
   if (i_a_s) stream_size++;
@@ -83,6 +109,9 @@ int open_input_streams(gang_decoder *dec) {
     fs_ctx[i].filter_graph   = NULL;
     fs_ctx[i].os             = NULL;
     fs_ctx[i].is             = i_v_s;
+    fs_ctx[i].copy           = 0;
+    fs_ctx[i].renditions     = dec->renditions;
+    fs_ctx[i].nb_renditions  = dec->nb_renditions;
     fs_ctx[i++].enc_id       = AV_CODEC_ID_H264;
   }
 
@@ -93,29 +122,91 @@ int open_input_streams(gang_decoder *dec) {
     fs_ctx[i].filter_graph   = NULL;
     fs_ctx[i].os             = NULL;
     fs_ctx[i].is             = i_a_s;
+    fs_ctx[i].copy           = 0;
+    fs_ctx[i].renditions     = NULL;
+    fs_ctx[i].nb_renditions  = 0;
     fs_ctx[i].enc_id         = AV_CODEC_ID_OPUS;
   }
   dec->fscs = fs_ctx;
 
+  for (i = 0; i < stream_size; i++) {
+    init_output_format(&fs_ctx[i]);
+  }
+
   return 0;
 }
 
-// Create os
-// Require is
-static int open_output_stream(FilterStreamContext *fsc, AVFormatContext *o_fmt_ctx) {
-  AVCodecContext *enc_ctx   = NULL;
+// Create os with the input codec parameters, packets are written as is.
+// return: 0->ok, 1->the muxer can not take the codec, <0->error
+static int open_copy_stream(FilterStreamContext *fsc, AVFormatContext *o_fmt_ctx) {
   AVCodecContext *i_dec_ctx = fsc->is->codec;
-  AVCodec        *encoder   = NULL;
+  int             ret;
+
+  if (avformat_query_codec(o_fmt_ctx->oformat, i_dec_ctx->codec_id, FF_COMPLIANCE_NORMAL) != 1) {
+    LOG_INFO("%s can not be muxed, transcode it", avcodec_get_name(i_dec_ctx->codec_id));
+    return 1;
+  }
+  fsc->os = avformat_new_stream(o_fmt_ctx, NULL);
+
+  if (!fsc->os) {
+    LOG_INFO("Failed allocating output stream");
+    return AVERROR_UNKNOWN;
+  }
+
+  ret = avcodec_copy_context(fsc->os->codec, i_dec_ctx);
+  if (ret < 0) {
+    LOG_INFO("Failed to copy codec context");
+    return ret;
+  }
+  fsc->os->codec->codec_tag = 0;
+  fsc->os->time_base        = fsc->is->time_base;
+
+  if (o_fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER) fsc->os->codec->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  fsc->copy = 1;
+
+  return 0;
+}
+
+// libopus options of profile, the rest goes to the context.
+static void set_audio_profile(AVCodecContext *enc_ctx, const GangAudioProfile *profile, AVDictionary **opts) {
+  static const char *const applications[] = {"audio", "voip", "lowdelay"};
+  char                     duration[16];
+
+  if (profile->bit_rate > 0) enc_ctx->bit_rate = profile->bit_rate;
+
+  if (profile->complexity >= 0) enc_ctx->compression_level = profile->complexity;
+
+  if ((profile->application >= GANG_OPUS_AUDIO) && (profile->application <= GANG_OPUS_LOWDELAY)) {
+    av_dict_set(opts, "application", applications[profile->application - GANG_OPUS_AUDIO], 0);
+  }
+
+  if (profile->frame_duration > 0) {
+    snprintf(duration, sizeof(duration), "%g", profile->frame_duration);
+    av_dict_set(opts, "frame_duration", duration, 0);
+  }
+}
+
+// Create os
+// Require is and output format
+static int open_output_stream(FilterStreamContext    *fsc,
+                              AVFormatContext        *o_fmt_ctx,
+                              int                     rec_copy,
+                              const GangAudioProfile *profile) {
+  AVCodecContext    *enc_ctx   = NULL;
+  AVCodecContext    *i_dec_ctx = fsc->is->codec;
+  AVCodec           *encoder   = NULL;
+  AVDictionary      *opts      = NULL;
+  AVDictionaryEntry *e         = NULL;
 
   AVRational rate;
-  int        i_chs         = i_dec_ctx->channels;
-  int        i_sample_rate = i_dec_ctx->sample_rate;
-  int        o_chs         = 0;
-  int        o_sample_rate = 0;
-  char       spec[255];
 
   int ret;
 
+  if (rec_copy) {
+    ret = open_copy_stream(fsc, o_fmt_ctx);
+    if (ret <= 0) return ret;
+  }
+
   /* in this example, we choose transcoding to same codec */
   encoder = avcodec_find_encoder(fsc->enc_id);
 
@@ -136,12 +227,10 @@ static int open_output_stream(FilterStreamContext *fsc, AVFormatContext *o_fmt_c
    * streams easily using filters */
   if (fsc->is_video) {
     enc_ctx->bit_rate            = i_dec_ctx->bit_rate;
-    enc_ctx->height              = i_dec_ctx->height;
-    enc_ctx->width               = i_dec_ctx->width;
+    enc_ctx->height              = fsc->height;
+    enc_ctx->width               = fsc->width;
     enc_ctx->sample_aspect_ratio = i_dec_ctx->sample_aspect_ratio;
-
-    /* take first format from list of supported formats */
-    enc_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    enc_ctx->pix_fmt             = fsc->pix_fmt;
 
     /* video time_base can be set to whatever is handy and supported by encoder
      */
@@ -158,9 +247,6 @@ static int open_output_stream(FilterStreamContext *fsc, AVFormatContext *o_fmt_c
 
     if (!rate.num || !rate.den) rate = av_make_q(25, 1);
 
-    // TODO add spec to fit in.
-    fsc->filter_spec = av_strdup("null");
-
     //		if (av_q2d(i_dec_ctx->time_base) * i_dec_ctx->ticks_per_frame >
     // av_q2d(fsc->is->time_base)	&& av_q2d(fsc->is->time_base) < 1.0 / 1000) {
     enc_ctx->time_base = av_inv_q(rate);
@@ -171,31 +257,33 @@ static int open_output_stream(FilterStreamContext *fsc, AVFormatContext *o_fmt_c
     //		}
     //		fsc->os->disposition = fsc->is->disposition;
   } else {
-    o_chs         = i_chs > 2 ? 2 : i_chs;
-    o_sample_rate = normalize_opus_rate(i_sample_rate);
-
-    enc_ctx->sample_rate    = o_sample_rate;
-    enc_ctx->channel_layout = av_get_default_channel_layout(o_chs);
-    enc_ctx->channels       = o_chs;
+    enc_ctx->sample_rate    = fsc->sample_rate;
+    enc_ctx->channel_layout = fsc->channel_layout;
+    enc_ctx->channels       = fsc->channels;
+    enc_ctx->sample_fmt     = fsc->sample_fmt;
+    enc_ctx->time_base.den  = fsc->sample_rate;
+    enc_ctx->time_base.num  = 1;
+    set_audio_profile(enc_ctx, profile, &opts);
+  }
 
-    /* take first format from list of supported formats */
-    enc_ctx->sample_fmt    = AV_SAMPLE_FMT_S16;
-    enc_ctx->time_base.den = o_sample_rate;
-    enc_ctx->time_base.num = 1;
+  ret = avcodec_open2(enc_ctx, encoder, &opts);
 
-    // Because the default d is 20ms
-    snprintf(spec, sizeof(spec), "asetnsamples=n=%d", o_sample_rate / 50);
-    fsc->filter_spec = av_strdup(spec);
+  // The native Opus encoder has none of the libopus options.
+  while ((e = av_dict_get(opts, "", e, AV_DICT_IGNORE_SUFFIX))) {
+    LOG_INFO("%s ignores %s=%s", encoder->name, e->key, e->value);
   }
-
-  /* Third parameter can be used to pass settings to encoder */
-  ret = avcodec_open2(enc_ctx, encoder, NULL);
+  av_dict_free(&opts);
 
   if (ret < 0) {
     LOG_INFO("Cannot open output stream: %s->%s", i_dec_ctx->codec->name, encoder->name);
     return ret;
   }
 
+  // The recording takes audio in frames of this size.
+  if (!fsc->is_video) {
+    LOG_DEBUG("%s frame_size: %d, bit_rate: %d", encoder->name, enc_ctx->frame_size, (int)enc_ctx->bit_rate);
+  }
+
   //	o_fmt_ctx->flags |= AVFMT_FLAG_GENPTS;
   //	o_fmt_ctx->flags |= AVFMT_FLAG_IGNDTS;
   if (o_fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER) enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
@@ -219,7 +307,7 @@ int open_output_streams(gang_decoder *dec, int rec) {
   }
 
   for (i = 0; i < dec->fsc_size; i++) {
-    ret = open_output_stream(&dec->fscs[i], dec->ofmt_ctx);
+    ret = open_output_stream(&dec->fscs[i], dec->ofmt_ctx, dec->rec_copy, &dec->audio_profile);
 
     if (ret < 0) {
       LOG_ERROR("open_output_stream failed");
@@ -254,19 +342,101 @@ int open_output_streams(gang_decoder *dec, int rec) {
   return 0;
 }
 
-#define SET_SINK_OPT(arg) ret = av_opt_set_bin(          \
-    buffersink_ctx, # arg "s", (uint8_t *)&enc_ctx->arg, \
-    sizeof(enc_ctx->arg), AV_OPT_SEARCH_CHILDREN);       \
-  if (ret < 0) {                                         \
-    LOG_INFO("Cannot set output "# arg "");              \
-    goto end;                                            \
+void close_output_streams(gang_decoder *dec) {
+  unsigned int i;
+
+  if (!dec->ofmt_ctx) {
+    return;
+  }
+
+  for (i = 0; i < dec->ofmt_ctx->nb_streams; i++) {
+    avcodec_close(dec->ofmt_ctx->streams[i]->codec);
+  }
+
+  if (dec->ofmt_ctx->pb && !(dec->ofmt_ctx->oformat->flags & AVFMT_NOFILE)) avio_closep(&dec->ofmt_ctx->pb);
+  avformat_free_context(dec->ofmt_ctx);
+  dec->ofmt_ctx  = NULL;
+  dec->recording = 0;
+
+  for (i = 0; i < dec->fsc_size; i++) {
+    dec->fscs[i].os   = NULL;
+    dec->fscs[i].copy = 0;
+  }
+}
+
+#define SET_SINK_OPT(arg) ret = av_opt_set_bin(      \
+    buffersink_ctx, # arg "s", (uint8_t *)&fsc->arg, \
+    sizeof(fsc->arg), AV_OPT_SEARCH_CHILDREN);       \
+  if (ret < 0) {                                     \
+    LOG_INFO("Cannot set output "# arg "");          \
+    goto end;                                        \
   }
 
-// Require os is filter_spec
+// Create a sink per rendition and the spec that feeds them:
+// [in]<filter_spec>,split=n+1[out][s0]..;[s0]scale=w:h[r0];..
+static int init_rendition_sinks(FilterStreamContext *fsc,
+                                AVFilterGraph       *filter_graph,
+                                AVFilter            *buffersink,
+                                char               **spec) {
+  GangRendition *r;
+  char           name[16];
+  size_t         size = 64 + strlen(fsc->filter_spec) + 64 * fsc->nb_renditions;
+  size_t         len;
+  int            i, ret;
+
+  if (!(*spec = av_malloc(size))) {
+    return AVERROR(ENOMEM);
+  }
+  len = snprintf(*spec, size, "[in]%s,split=%d[out]", fsc->filter_spec, fsc->nb_renditions + 1);
+
+  for (i = 0; i < fsc->nb_renditions; i++) {
+    len += snprintf(*spec + len, size - len, "[s%d]", i);
+  }
+
+  for (i = 0; i < fsc->nb_renditions; i++) {
+    r    = &fsc->renditions[i];
+    len += snprintf(*spec + len, size - len, ";[s%d]scale=%d:%d[r%d]", i, r->width, r->height, i);
+
+    snprintf(name, sizeof(name), "r%d", i);
+    ret = avfilter_graph_create_filter(&r->buffersink_ctx, buffersink, name, NULL, NULL, filter_graph);
+    if (ret < 0) {
+      LOG_INFO("Cannot create rendition sink %d", i);
+      return ret;
+    }
+
+    ret = av_opt_set_bin(r->buffersink_ctx, "pix_fmts", (uint8_t *)&fsc->pix_fmt,
+                         sizeof(fsc->pix_fmt), AV_OPT_SEARCH_CHILDREN);
+    if (ret < 0) {
+      LOG_INFO("Cannot set output pix_fmt of rendition %d", i);
+      return ret;
+    }
+  }
+  LOG_DEBUG("Video filter spec: %s", *spec);
+  return 0;
+}
+
+// Prepend the sink of rendition i to the open inputs of the graph.
+static int add_rendition_input(AVFilterInOut **inputs, GangRendition *r, int i) {
+  AVFilterInOut *input = avfilter_inout_alloc();
+  char           name[16];
+
+  if (!input) {
+    return AVERROR(ENOMEM);
+  }
+  snprintf(name, sizeof(name), "r%d", i);
+  input->name       = av_strdup(name);
+  input->filter_ctx = r->buffersink_ctx;
+  input->pad_idx    = 0;
+  input->next       = *inputs;
+  *inputs           = input;
+
+  return input->name ? 0 : AVERROR(ENOMEM);
+}
+
+// Require output format and filter_spec
 static int init_filter(FilterStreamContext *fsc) {
   char             args[512];
   int              ret            = 0;
-  AVCodecContext  *enc_ctx        = NULL;
   AVCodecContext  *dec_ctx        = NULL;
   AVFilter        *buffersrc      = NULL;
   AVFilter        *buffersink     = NULL;
@@ -275,12 +445,14 @@ static int init_filter(FilterStreamContext *fsc) {
   AVFilterInOut   *outputs        = NULL;
   AVFilterInOut   *inputs         = NULL;
   AVFilterGraph   *filter_graph   = NULL;
+  char            *spec           = NULL;
+  int              i;
 
-  if (!fsc->is) {
+  // Audio is converted without a graph.
+  if (!fsc->is || !fsc->is_video) {
     return ret;
   }
 
-  enc_ctx      = fsc->os->codec;
   dec_ctx      = fsc->is->codec;
   outputs      = avfilter_inout_alloc();
   inputs       = avfilter_inout_alloc();
@@ -292,81 +464,44 @@ static int init_filter(FilterStreamContext *fsc) {
     goto end;
   }
 
-  if (fsc->is_video) {
-    buffersrc  = avfilter_get_by_name("buffer");
-    buffersink = avfilter_get_by_name("buffersink");
-
-    if (!buffersrc || !buffersink) {
-      LOG_INFO("filtering source or sink element not found");
-      ret = AVERROR_UNKNOWN;
-      goto end;
-    }
-
-    snprintf(
-      args,
-      sizeof(args),
-      "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
-      dec_ctx->width,
-      dec_ctx->height,
-      dec_ctx->pix_fmt,
-      dec_ctx->time_base.num,
-      dec_ctx->time_base.den,
-      dec_ctx->sample_aspect_ratio.num,
-      dec_ctx->sample_aspect_ratio.den);
-
-    ret = avfilter_graph_create_filter(&buffersrc_ctx, buffersrc, "in", args,  NULL, filter_graph);
-    if (ret < 0) {
-      LOG_INFO("Cannot create buffer source");
-      goto end;
-    }
+  buffersrc  = avfilter_get_by_name("buffer");
+  buffersink = avfilter_get_by_name("buffersink");
 
-    ret = avfilter_graph_create_filter(&buffersink_ctx, buffersink, "out", NULL, NULL, filter_graph);
-    if (ret < 0) {
-      LOG_INFO("Cannot create buffer sink");
-      goto end;
-    }
-    SET_SINK_OPT(pix_fmt)
-  } else if (dec_ctx->codec_type == AVMEDIA_TYPE_AUDIO) {
-    buffersrc  = avfilter_get_by_name("abuffer");
-    buffersink = avfilter_get_by_name("abuffersink");
-
-    if (!buffersrc || !buffersink) {
-      LOG_INFO("filtering source or sink element not found");
-      ret = AVERROR_UNKNOWN;
-      goto end;
-    }
-
-    if (!dec_ctx->channel_layout) dec_ctx->channel_layout = av_get_default_channel_layout(dec_ctx->channels);
-    snprintf(
-      args,
-      sizeof(args),
-      "time_base=%d/%d:sample_rate=%d:sample_fmt=%s:channel_layout=0x%" PRIx64,
-      dec_ctx->time_base.num,
-      dec_ctx->time_base.den,
-      dec_ctx->sample_rate,
-      av_get_sample_fmt_name(dec_ctx->sample_fmt),
-      dec_ctx->channel_layout);
-    ret = avfilter_graph_create_filter(&buffersrc_ctx, buffersrc, "in", args, NULL, filter_graph);
-
-    if (ret < 0) {
-      LOG_INFO("Cannot create audio buffer source");
-      goto end;
-    }
-
-    ret = avfilter_graph_create_filter(&buffersink_ctx, buffersink, "out", NULL, NULL, filter_graph);
+  if (!buffersrc || !buffersink) {
+    LOG_INFO("filtering source or sink element not found");
+    ret = AVERROR_UNKNOWN;
+    goto end;
+  }
 
-    if (ret < 0) {
-      LOG_INFO("Cannot create audio buffer sink");
-      goto end;
-    }
+  snprintf(
+    args,
+    sizeof(args),
+    "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
+    dec_ctx->width,
+    dec_ctx->height,
+    dec_ctx->pix_fmt,
+    dec_ctx->time_base.num,
+    dec_ctx->time_base.den,
+    dec_ctx->sample_aspect_ratio.num,
+    dec_ctx->sample_aspect_ratio.den);
+
+  ret = avfilter_graph_create_filter(&buffersrc_ctx, buffersrc, "in", args,  NULL, filter_graph);
+  if (ret < 0) {
+    LOG_INFO("Cannot create buffer source");
+    goto end;
+  }
 
-    SET_SINK_OPT(sample_fmt)
-    SET_SINK_OPT(channel_layout)
-    SET_SINK_OPT(sample_rate)
-  } else {
-    ret = AVERROR_UNKNOWN;
+  ret = avfilter_graph_create_filter(&buffersink_ctx, buffersink, "out", NULL, NULL, filter_graph);
+  if (ret < 0) {
+    LOG_INFO("Cannot create buffer sink");
     goto end;
   }
+  SET_SINK_OPT(pix_fmt)
+
+  if (fsc->nb_renditions) {
+    ret = init_rendition_sinks(fsc, filter_graph, buffersink, &spec);
+    if (ret < 0) goto end;
+  }
 
   /* Endpoints for the filter graph. */
   outputs->name       = av_strdup("in");
@@ -384,7 +519,11 @@ static int init_filter(FilterStreamContext *fsc) {
     goto end;
   }
 
-  if ((ret = avfilter_graph_parse_ptr(filter_graph, fsc->filter_spec, &inputs, &outputs, NULL)) < 0) goto end;
+  for (i = fsc->nb_renditions - 1; i >= 0; i--) {
+    if ((ret = add_rendition_input(&inputs, &fsc->renditions[i], i)) < 0) goto end;
+  }
+
+  if ((ret = avfilter_graph_parse_ptr(filter_graph, spec ? spec : fsc->filter_spec, &inputs, &outputs, NULL)) < 0) goto end;
 
   if ((ret = avfilter_graph_config(filter_graph, NULL)) < 0) goto end;
 
@@ -395,11 +534,28 @@ static int init_filter(FilterStreamContext *fsc) {
 
 end: avfilter_inout_free(&inputs);
   avfilter_inout_free(&outputs);
+  av_free(spec);
 
   if (ret > 0) ret = 0;
   return ret;
 }
 
+int reset_filter(FilterStreamContext *fsc) {
+  int i;
+
+  if (fsc->filter_graph) {
+    avfilter_graph_free(&fsc->filter_graph);
+  }
+  fsc->buffersrc_ctx  = NULL;
+  fsc->buffersink_ctx = NULL;
+
+  for (i = 0; i < fsc->nb_renditions; i++) {
+    fsc->renditions[i].buffersink_ctx = NULL;
+    fsc->renditions[i].ready          = 0;
+  }
+  return init_filter(fsc);
+}
+
 int init_filters(FilterStreamContext *fscs, size_t n) {
   unsigned int i;
   int          ret;
@@ -412,83 +568,156 @@ int init_filters(FilterStreamContext *fscs, size_t n) {
   return 0;
 }
 
+// Files start on a keyframe of video, or of audio when there is no video.
+// return: 1->drop until then, 0->write
+static int wait_keyframe(gang_decoder *dec, FilterStreamContext *fsc, const AVPacket *pkt) {
+  if (!dec->waitkey) {
+    return 0;
+  }
+
+  if ((fsc->is_video || dec->no_video) && (pkt->flags & AV_PKT_FLAG_KEY)) {
+    dec->waitkey = 0;
+    return 0;
+  }
+  return 1;
+}
+
+int copy_write_packet(gang_decoder *dec, FilterStreamContext *fsc, const AVPacket *pkt) {
+  int ret;
+
+  if (wait_keyframe(dec, fsc, pkt)) {
+    return 0;
+  }
+
+  av_packet_unref(&dec->o_pkt);
+  ret = av_packet_ref(&dec->o_pkt, pkt);
+  if (ret < 0) {
+    LOG_INFO("Could not ref packet to copy");
+    return ret;
+  }
+
+  dec->o_pkt.stream_index = fsc->os->index;
+  dec->o_pkt.pos          = -1;
+  av_packet_rescale_ts(&dec->o_pkt, fsc->is->time_base, fsc->os->time_base);
+
+  return av_interleaved_write_frame(dec->ofmt_ctx, &dec->o_pkt);
+}
+
+// TOC config of a frame of n 2.5ms units, CELT fullband up to 20ms, SILK
+// wideband above, -1 for none.
+static int opus_config(int units) {
+  switch (units) {
+    case 1:  return 28;
+
+    case 2:  return 29;
+
+    case 4:  return 30;
+
+    case 8:  return 31;
+
+    case 16: return 10;
+
+    case 24: return 11;
+
+    default: return -1;
+  }
+}
+
+int write_dtx_frame(gang_decoder *dec, FilterStreamContext *fsc) {
+  AVCodecContext *enc    = fsc->os->codec;
+  AVFrame        *frame  = dec->o_frame;
+  int             config = -1;
+  int             ret;
+
+  if ((enc->codec_id == AV_CODEC_ID_OPUS) && !(frame->nb_samples * 400 % enc->sample_rate)) {
+    config = opus_config(frame->nb_samples * 400 / enc->sample_rate);
+  }
+
+  if (config < 0) {
+    return AVERROR(ENOSYS);
+  }
+
+  if (wait_keyframe(dec, fsc, &dec->i_pkt)) {
+    return 0;
+  }
+
+  av_packet_unref(&dec->o_pkt);
+  ret = av_new_packet(&dec->o_pkt, 1);
+  if (ret < 0) return ret;
+
+  // Code 0, one frame, and no frame data.
+  dec->o_pkt.data[0]      = (uint8_t)((config << 3) | (enc->channels > 1 ? 0x4 : 0));
+  dec->o_pkt.stream_index = fsc->os->index;
+  dec->o_pkt.duration     = frame->nb_samples;
+
+  // On the timeline of the encoded packets, which lead by the padding.
+  if (frame->pts != AV_NOPTS_VALUE) {
+    dec->o_pkt.pts = frame->pts - enc->initial_padding;
+    dec->o_pkt.dts = dec->o_pkt.pts;
+  }
+  av_packet_rescale_ts(&dec->o_pkt, enc->time_base, fsc->os->time_base);
+  return av_interleaved_write_frame(dec->ofmt_ctx, &dec->o_pkt);
+}
+
+// Send a filtered frame, or NULL to flush when got_frame is given, and mux
+// every packet the encoder has ready. got_frame is left 0 as the encoder
+// is drained in one call.
 int encode_write_frame(gang_decoder *dec, FilterStreamContext *fsc, int *got_frame) {
-  AVStream *os = fsc->os;
-  int       ret;
-  int       got_frame_local;
+  AVStream *os      = fsc->os;
   AVFrame  *o_frame = got_frame ? NULL : dec->o_frame;
+  int       ret;
 
-  int (*enc_func)(AVCodecContext *,
-                  AVPacket *,
-                  const AVFrame *,
-                  int *) =
-    fsc->is_video ? avcodec_encode_video2 : avcodec_encode_audio2;
+  if (got_frame) *got_frame = 0;
 
-  if (dec->waitkey) {
-    if (dec->i_pkt.flags & AV_PKT_FLAG_KEY) {
-      dec->waitkey = 0;
-    } else  return 0;
+  if (wait_keyframe(dec, fsc, &dec->i_pkt)) {
+    return 0;
   }
 
-  if (!got_frame) got_frame = &got_frame_local;
-
   /* encode filtered frame */
-  av_packet_unref(&dec->o_pkt);
-  av_init_packet(&dec->o_pkt);
+  ret = avcodec_send_frame(os->codec, o_frame);
+  if (ret == AVERROR_EOF) return 0;
 
-  ret = enc_func(os->codec, &dec->o_pkt, o_frame, got_frame);
   if (ret < 0) {
-    LOG_INFO("enc_func error");
+    LOG_INFO("avcodec_send_frame error");
     return ret;
   }
 
-  if (!(*got_frame)) return 0;
+  while (1) {
+    av_packet_unref(&dec->o_pkt);
+    av_init_packet(&dec->o_pkt);
 
-  /* prepare packet for muxing */
-  dec->o_pkt.stream_index = os->index;
+    ret = avcodec_receive_packet(os->codec, &dec->o_pkt);
+    if ((ret == AVERROR(EAGAIN)) || (ret == AVERROR_EOF)) return 0;
 
-  //	dec->o_pkt.dts = AV_NOPTS_VALUE;
-  if (fsc->is_video) {
-    //		dec->o_pkt.duration *= 2 * dec->o_pkt.size;
-    av_packet_rescale_ts(&dec->o_pkt, fsc->is->codec->time_base, os->time_base);
-  } else {
-    av_packet_rescale_ts(&dec->o_pkt, os->codec->time_base, os->time_base);
-  }
-
-  //	if (fsc->is_video) {
-  //		dec->o_pkt.pts /= os->codec->ticks_per_frame;
-  //		dec->o_pkt.dts /= os->codec->ticks_per_frame;
-  //		dec->o_pkt.duration /= os->codec->ticks_per_frame;
-  //	}
-  //	if (fsc->is_video) {
-  //		dec->o_pkt.pts = dec->pts_video++;
-  //		dec->o_pkt.dts = dec->o_pkt.pts;
-  //		av_packet_rescale_ts(&dec->o_pkt, (AVRational ) {2, 25},
-  // os->time_base);
-  //	} else {
-  //		dec->o_pkt.pts = dec->pts_audio++ * (dec->o_pkt.size * 1000 /
-  // os->codec->sample_rate);
-  //	}
-
-  /* mux encoded frame */
-  ret = av_interleaved_write_frame(dec->ofmt_ctx, &dec->o_pkt);
-  return ret;
+    if (ret < 0) {
+      LOG_INFO("avcodec_receive_packet error");
+      return ret;
+    }
+
+    /* prepare packet for muxing */
+    dec->o_pkt.stream_index = os->index;
+
+    // Filtered video keeps the pts of the sink, an fps filter changes its
+    // time base from the decoder's, see apply_video_format.
+    if (fsc->is_video) {
+      av_packet_rescale_ts(&dec->o_pkt, fsc->buffersink_ctx->inputs[0]->time_base, os->time_base);
+    } else {
+      av_packet_rescale_ts(&dec->o_pkt, os->codec->time_base, os->time_base);
+    }
+
+    /* mux encoded frame */
+    ret = av_interleaved_write_frame(dec->ofmt_ctx, &dec->o_pkt);
+    if (ret < 0) return ret;
+  }
 }
 
 int flush_encoder(gang_decoder *dec, FilterStreamContext *fsc) {
-  int ret;
   int got_frame;
 
-  if (!(fsc->os->codec->codec->capabilities & AV_CODEC_CAP_DELAY)) return 0;
-
-  while (1) {
-    // LOG_DEBUG("Flushing stream #%u encoder", fsc->os->index);
-    ret = encode_write_frame(dec, fsc, &got_frame);
-    if (ret < 0) break;
+  if (fsc->copy || !(fsc->os->codec->codec->capabilities & AV_CODEC_CAP_DELAY)) return 0;
 
-    if (!got_frame) return 0;
-  }
-  return ret;
+  // LOG_DEBUG("Flushing stream #%u encoder", fsc->os->index);
+  return encode_write_frame(dec, fsc, &got_frame);
 }
 
 int find_fs_index(int *index, FilterStreamContext *fscs, size_t fs_size, int stream_index) {
@@ -11,13 +11,33 @@ int open_input_streams(gang_decoder *dec);
 int open_output_streams(gang_decoder *dec,
                         int           record_enabled);
 
+// Free ofmt_ctx and all os, closing the record file without trailer.
+void close_output_streams(gang_decoder *dec);
+
 int init_filters(FilterStreamContext *fscs,
                  size_t               n);
 
+// Free the graph of fsc and build it again from filter_spec, frames still
+// in the old one are dropped.
+// return error
+int reset_filter(FilterStreamContext *fsc);
+
+// Write an input packet of a copy stream to the record file.
+int copy_write_packet(gang_decoder        *dec,
+                      FilterStreamContext *fsc,
+                      const AVPacket      *pkt);
+
 int encode_write_frame(gang_decoder        *dec,
                        FilterStreamContext *fsc,
                        int                 *got_frame);
 
+// Write a silent audio frame of dec->o_frame as an Opus frame of no data,
+// which players conceal as the silence before it, RFC 6716 3.2.1. The
+// encoder is not run. return: AVERROR(ENOSYS) for a frame size Opus does
+// not have, error
+int write_dtx_frame(gang_decoder        *dec,
+                    FilterStreamContext *fsc);
+
 int flush_encoder(gang_decoder        *dec,
                   FilterStreamContext *fsc);
 
@@ -4,6 +4,7 @@
 #include "webrtc/base/thread.h"
 #include "webrtc/base/timeutils.h"
 
+#include "gang_audio_mix.h"
 #include "gang_spdlog_console.h"
 
 namespace gang {
@@ -16,19 +17,26 @@ namespace gang {
 // https://code.google.com/p/webrtc/
 static const uint32 kAdmMaxIdleTimeProcess = 1000;
 
-// Constants here are derived by running VoE using a real ADM.
-// The constants correspond to 10ms of mono audio at 44kHz.
+// Blocks are delivered every 10ms while recording. After a longer stall of
+// the process thread only this many are caught up, the rest is skipped.
+static const uint32 kDeliverIntervalMs = 10;
+static const uint32 kMaxCatchUpBlocks  = 5;
+
+// The delay is measured per block. Drift is resampled away by the decoders,
+// so webrtc sees none.
 static const uint32_t kTotalDelayMs = 0;
 static const int32_t  kClockDriftMs = 0;
 
-GangAudioDevice::GangAudioDevice(shared_ptr<GangDecoder> decoder) :
+GangAudioDevice::GangAudioDevice(const std::vector<shared_ptr<GangDecoder> >& decoders) :
   last_process_time_ms_(0),
+  next_deliver_ms_(0),
   audio_callback_(NULL),
   recording_(false),
   rec_is_initialized_(false),
-  decoder_(decoder),
+  decoders_(decoders),
   len_bytes_per_10ms_(0),
   nb_samples_10ms_(0),
+  restart_(false),
   _recSampleRate(0),
   _recChannels(0),
   _recChannel(AudioDeviceModule::kChannelBoth),
@@ -39,7 +47,8 @@ GangAudioDevice::GangAudioDevice(shared_ptr<GangDecoder> decoder) :
   _totalDelayMS(kTotalDelayMs),
   _clockDrift(kClockDriftMs),
   _record_index(0) {
-  memset(rec_buff_, 0, kMaxBufferSizeBytes);
+  memset(rec_buff_, 0, sizeof(rec_buff_));
+  memset(src_buff_, 0, sizeof(src_buff_));
   SPDLOG_TRACE(console, "{}", __func__)
 }
 
@@ -49,26 +58,51 @@ GangAudioDevice::~GangAudioDevice() {
 
   if (recording_) {
     recording_ = false;
-    decoder_->SetAudioFrameObserver(NULL, NULL);
+
+    for (auto& source : sources_) source->Stop();
   }
-  decoder_ = NULL;
+  sources_.clear();
+  decoders_.clear();
   SPDLOG_TRACE(console, "{} {}", __func__, "error")
 }
 
 rtc::scoped_refptr<GangAudioDevice> GangAudioDevice::Create(shared_ptr<GangDecoder> decoder) {
-  if (!decoder) {
+  return Create(std::vector<shared_ptr<GangDecoder> >(1, decoder));
+}
+
+rtc::scoped_refptr<GangAudioDevice> GangAudioDevice::Create(const std::vector<shared_ptr<GangDecoder> >& decoders) {
+  if (decoders.empty()) {
     return NULL;
   }
+
+  for (auto& decoder : decoders) {
+    if (!decoder) {
+      return NULL;
+    }
+  }
   rtc::scoped_refptr<GangAudioDevice> capture_module(
-    new rtc::RefCountedObject<GangAudioDevice>(decoder));
+    new rtc::RefCountedObject<GangAudioDevice>(decoders));
   capture_module->Initialize();
   return capture_module;
 }
 
+bool GangAudioDevice::SetSourceGain(size_t index, float gain) {
+  if (index >= sources_.size() || !sources_[index]) {
+    return false;
+  }
+  sources_[index]->SetGain(gain);
+  return true;
+}
+
 int64_t GangAudioDevice::TimeUntilNextProcess() {
   //	SPDLOG_TRACE(console, "{}", __func__)
   const uint32 current_time = rtc::Time();
 
+  if (Recording()) {
+    const int32 until_next = static_cast<int32>(next_deliver_ms_ - current_time);
+    return until_next > 0 ? until_next : 0;
+  }
+
   if (current_time < last_process_time_ms_) {
     // TODO: wraparound could be handled more gracefully.
     return 0;
@@ -81,9 +115,49 @@ int64_t GangAudioDevice::TimeUntilNextProcess() {
   return kAdmMaxIdleTimeProcess - elapsed_time;
 }
 
+// Deliver every 10ms block that is due, mixed from the sources.
 int32_t GangAudioDevice::Process() {
   //	SPDLOG_TRACE(console, "{}", __func__)
   last_process_time_ms_ = rtc::Time();
+
+  if (!Recording()) {
+    return 0;
+  }
+
+  if (restart_.exchange(false)) {
+    next_deliver_ms_ = last_process_time_ms_;
+  }
+
+  for (auto& source : sources_) {
+    if (source) source->Prepare();
+  }
+
+  if (static_cast<int32>(last_process_time_ms_ - next_deliver_ms_) >
+      static_cast<int32>(kMaxCatchUpBlocks * kDeliverIntervalMs)) {
+    next_deliver_ms_ = last_process_time_ms_ - kMaxCatchUpBlocks * kDeliverIntervalMs;
+  }
+
+  while (static_cast<int32>(last_process_time_ms_ - next_deliver_ms_) >= 0) {
+    bool mixed = false;
+
+    next_deliver_ms_ += kDeliverIntervalMs;
+    memset(rec_buff_, 0, len_bytes_per_10ms_);
+
+    // A source that underruns is silent in this block.
+    for (auto& source : sources_) {
+      if (!source || !source->Read(src_buff_)) continue;
+
+      MixS16(rec_buff_, src_buff_, nb_samples_10ms_ * _recChannels, source->Gain());
+      mixed = true;
+    }
+
+    if (!mixed) {
+      // Underrun of all, wait for the decoders instead of inserting silence.
+      break;
+    }
+    _totalDelayMS = BufferedMs();
+    DeliverRecordedData();
+  }
   return 0;
 }
 
@@ -128,7 +202,7 @@ int32_t GangAudioDevice::Terminate() {
 
 bool GangAudioDevice::Initialized() const {
   SPDLOG_TRACE(console, "{}", __func__)
-  return decoder_.get() != NULL;
+  return !decoders_.empty();
 }
 
 int16_t GangAudioDevice::PlayoutDevices() {
@@ -254,7 +328,13 @@ int32_t GangAudioDevice::StartRecording() {
   SPDLOG_DEBUG(console, "{}", __func__)
   rtc::CritScope cs(&lock_);
   recording_ = true;
-  decoder_->SetAudioFrameObserver(this, rec_buff_);
+
+  // Sources drop what is left from last recording.
+  restart_ = true;
+
+  for (auto& source : sources_) {
+    if (source) source->Start();
+  }
   return 0;
 }
 
@@ -264,7 +344,9 @@ int32_t GangAudioDevice::StopRecording() {
   rtc::CritScope cs(&lock_);
 
   if (recording_) {
-    decoder_->SetAudioFrameObserver(NULL, NULL);
+    for (auto& source : sources_) {
+      if (source) source->Stop();
+    }
   }
   recording_ = false;
   return 0;
@@ -489,12 +571,14 @@ int32_t GangAudioDevice::PlayoutBuffer(BufferType * /*type*/, uint16_t * /*size_
 
 int32_t GangAudioDevice::PlayoutDelay(uint16_t *delay_ms) const {
   SPDLOG_TRACE(console, "{}", __func__)
+  *delay_ms = 0;
   return 0;
 }
 
-int32_t GangAudioDevice::RecordingDelay(uint16_t * /*delay_ms*/) const {
+int32_t GangAudioDevice::RecordingDelay(uint16_t *delay_ms) const {
   SPDLOG_TRACE(console, "{}", __func__)
-  return -1;
+  *delay_ms = static_cast<uint16_t>(BufferedMs());
+  return 0;
 }
 
 int32_t GangAudioDevice::CPULoad(uint16_t * /*load*/) const {
@@ -569,7 +653,8 @@ void GangAudioDevice::Initialize() {
   SPDLOG_TRACE(console, "{}", __func__)
   last_process_time_ms_ = rtc::Time();
 
-  decoder_->GetAudioInfo(&_recSampleRate, &_recChannels);
+  // The mix takes the format of the first decoder.
+  decoders_[0]->GetAudioInfo(&_recSampleRate, &_recChannels);
 
   // 16 bits per sample in mono, 32 bits in stereo
   _recBytesPerSample = 2 * static_cast<size_t>(_recChannels);
@@ -601,14 +686,27 @@ void GangAudioDevice::Initialize() {
   // init rec_rest_buff_ 10ms container
   len_bytes_per_10ms_ = nb_samples_10ms_ * _recBytesPerSample;
 
-  rec_is_initialized_ = true;
+  // Sources keep their index for SetSourceGain, NULL when left out.
+  for (auto& decoder : decoders_) {
+    std::unique_ptr<GangAudioSource> source(new GangAudioSource(decoder, _recSampleRate, _recChannels));
+
+    if (!source->Init()) {
+      console->warn("{}: a source is left out of the mix", __func__);
+      source.reset();
+    }
+    sources_.push_back(std::move(source));
+  }
+
+  rec_is_initialized_ = sources_[0].get() != NULL;
 }
 
-void GangAudioDevice::OnGangFrame() {
-  if (!audio_callback_) {
-    return;
+int GangAudioDevice::BufferedMs() const {
+  int ms = 0;
+
+  for (auto& source : sources_) {
+    if (source && (source->BufferedMs() > ms)) ms = source->BufferedMs();
   }
-  DeliverRecordedData();
+  return ms;
 }
 
 // ----------------------------------------------------------------------------
@@ -616,6 +714,11 @@ void GangAudioDevice::OnGangFrame() {
 // ----------------------------------------------------------------------------
 
 int32_t GangAudioDevice::DeliverRecordedData() {
+  rtc::CritScope cs(&lockCb_);
+
+  if (!audio_callback_) {
+    return 0;
+  }
   uint32_t newMicLevel(0);
   int32_t  res = audio_callback_->RecordedDataIsAvailable(
     static_cast<void *>(rec_buff_),
@@ -1,10 +1,14 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <vector>
 #include "webrtc/base/basictypes.h"
 #include "webrtc/common_types.h"
 #include "webrtc/modules/audio_device/include/audio_device.h"
 #include "webrtc/base/criticalsection.h"
+#include "webrtc/base/scoped_ptr.h"
+#include "gang_audio_source.h"
 #include "gang_decoder.h"
 
 namespace rtc {
@@ -20,15 +24,22 @@ using webrtc::kAdmMaxFileNameSize;
 using webrtc::kAdmMaxGuidSize;
 
 namespace gang {
-const uint32_t kMaxBufferSizeBytes = 3840; // 10ms in stereo @ 96kHz
-
-class GangAudioDevice : public AudioDeviceModule, public GangFrameObserver {
+class GangAudioDevice : public AudioDeviceModule {
 public:
   // Creates a GangAudioDevice or returns NULL on failure.
   // |process_thread| is used to push and pull audio frames to and from the
   // returned instance. Note: ownership of |process_thread| is not handed over.
   static rtc::scoped_refptr<GangAudioDevice> Create(shared_ptr<GangDecoder> decoder);
 
+  // One track carrying the mix of every decoder, in the audio format of the
+  // first one. Decoders whose audio can not be converted are left out.
+  static rtc::scoped_refptr<GangAudioDevice> Create(const std::vector<shared_ptr<GangDecoder> >& decoders);
+
+  // Gain of a source in the order given to Create, 1.0 is unity and up to
+  // 2.0. return: false for an unknown source
+  bool SetSourceGain(size_t index,
+                     float  gain);
+
   // Following functions are inherited from webrtc::AudioDeviceModule.
   // Only functions called by PeerConnection are implemented, the rest do
   // nothing and return success. If a function is not expected to be called by
@@ -159,8 +170,6 @@ public:
 
   int32_t      DeliverRecordedData();
 
-  virtual void OnGangFrame() override;
-
   // The destructor is protected because it is reference counted and should not
   // be deleted directly.
   virtual ~GangAudioDevice();
@@ -171,15 +180,21 @@ protected:
   // exposed in which case the burden of proper instantiation would be put on
   // the creator of a GangAudioDevice instance. To create an instance of
   // this class use the Create(..) API.
-  explicit GangAudioDevice(shared_ptr<GangDecoder> decoder);
+  explicit GangAudioDevice(const std::vector<shared_ptr<GangDecoder> >& decoders);
 
 private:
   void Initialize();
 
+  // Most audio waiting in a source, from any thread.
+  int  BufferedMs() const;
+
   // The time in milliseconds when Process() was last called or 0 if no call
   // has been made.
   uint32 last_process_time_ms_;
 
+  // The time in milliseconds when the next 10ms block is due.
+  uint32 next_deliver_ms_;
+
   // Callback for playout and recording.
   webrtc::AudioTransport *audio_callback_;
 
@@ -188,14 +203,20 @@ private:
 
   bool rec_is_initialized_; // True when the instance is ready to push audio.
 
-  // User provided thread context.
-  shared_ptr<GangDecoder> decoder_;
+  // Each source queues the audio of its decoder, Process() mixes the 10ms
+  // blocks into rec_buff_.
+  std::vector<shared_ptr<GangDecoder> >          decoders_;
+  std::vector<std::unique_ptr<GangAudioSource> > sources_;
 
   // 10ms in stereo @ 96kHz
-  uint8_t rec_buff_[kMaxBufferSizeBytes];
+  int16_t rec_buff_[kMaxBufferSizeBytes / 2];
+  int16_t src_buff_[kMaxBufferSizeBytes / 2];
   size_t  len_bytes_per_10ms_;
   size_t  nb_samples_10ms_;
 
+  // Set by StartRecording, Process() delivers from then on.
+  std::atomic<bool> restart_;
+
   mutable rtc::CriticalSection lock_;
   mutable rtc::CriticalSection lockCb_;
 
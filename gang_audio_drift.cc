@@ -0,0 +1,110 @@
+#include "gang_audio_drift.h"
+
+#include <math.h>
+
+namespace gang {
+namespace {
+// Lateness minima are taken over windows of this length.
+const int64_t kWindowUs = 10000000;
+
+// A source time this far off the last one starts a new timeline.
+const int64_t kJumpUs = 1000000;
+
+// Real clocks are a few hundred ppm apart at worst, more is a stall.
+const double kMaxDriftPpm = 1000;
+const double kDriftAlpha  = 0.25;
+
+// Per 10ms block, about a second to follow the buffer level.
+const double kLevelAlpha = 0.01;
+
+// ppm per ms off target. Held under 0.2%, a pitch change nobody hears,
+// and moved in steps so the resampler is not reset on every block.
+const double kLevelGainPpm = 20;
+const int    kMaxCompPpm   = 2000;
+const int    kCompStepPpm  = 10;
+} // namespace
+
+AudioDriftEstimator::AudioDriftEstimator(int target_ms) :
+  target_ms_(target_ms),
+  drift_ppm_(0),
+  have_drift_(false) {
+  Reset();
+}
+
+void AudioDriftEstimator::Reset() {
+  started_     = false;
+  src0_us_     = 0;
+  t0_us_       = 0;
+  last_src_us_ = 0;
+  window_us_   = 0;
+  window_min_  = 0;
+  have_min_    = false;
+  prev_min_    = 0;
+  prev_us_     = 0;
+  have_prev_   = false;
+  level_ms_    = 0;
+  have_level_  = false;
+}
+
+void AudioDriftEstimator::Update(int64_t src_us, int64_t now_us, int buffered_ms) {
+  level_ms_   = have_level_ ? level_ms_ + kLevelAlpha * (buffered_ms - level_ms_) : buffered_ms;
+  have_level_ = true;
+
+  if (src_us == INT64_MIN) {
+    return;
+  }
+
+  if (started_ && ((src_us < last_src_us_ - kJumpUs) || (src_us > last_src_us_ + kJumpUs))) {
+    started_ = false;
+  }
+  last_src_us_ = src_us;
+
+  if (!started_) {
+    started_   = true;
+    src0_us_   = src_us;
+    t0_us_     = now_us;
+    window_us_ = now_us;
+    have_min_  = false;
+    have_prev_ = false;
+    return;
+  }
+  int64_t lateness = (now_us - t0_us_) - (src_us - src0_us_);
+
+  if (!have_min_ || (lateness < window_min_)) {
+    window_min_ = lateness;
+    have_min_   = true;
+  }
+
+  if (now_us - window_us_ < kWindowUs) {
+    return;
+  }
+
+  // A fast source gets ahead of the local clock, its lateness shrinks.
+  if (have_prev_) {
+    double ppm = -1e6 * (window_min_ - prev_min_) / (now_us - prev_us_);
+
+    if (fabs(ppm) <= kMaxDriftPpm) {
+      drift_ppm_  = have_drift_ ? drift_ppm_ + kDriftAlpha * (ppm - drift_ppm_) : ppm;
+      have_drift_ = true;
+    }
+  }
+  prev_min_  = window_min_;
+  prev_us_   = now_us;
+  have_prev_ = true;
+  window_us_ = now_us;
+  have_min_  = false;
+}
+
+int AudioDriftEstimator::DriftPpm() const {
+  return static_cast<int>(lround(drift_ppm_));
+}
+
+int AudioDriftEstimator::CompensationPpm() const {
+  double ppm = -drift_ppm_ - kLevelGainPpm * (level_ms_ - target_ms_);
+
+  if (ppm > kMaxCompPpm) ppm = kMaxCompPpm;
+
+  if (ppm < -kMaxCompPpm) ppm = -kMaxCompPpm;
+  return static_cast<int>(lround(ppm / kCompStepPpm)) * kCompStepPpm;
+}
+} // namespace gang
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include "webrtc/base/constructormagic.h"
+
+namespace gang {
+// Follows the source audio clock against the local monotonic one and works
+// out the resampling that holds the buffered audio at target_ms. Network
+// jitter only delays blocks, so the drift is taken from the lower envelope
+// of their lateness. Used by the producer thread only.
+class AudioDriftEstimator {
+public:
+  explicit AudioDriftEstimator(int target_ms);
+
+  // Start over on a new source timeline, the drift estimate is kept.
+  void Reset();
+
+  // A block with source time src_us, INT64_MIN when not known, arrived at
+  // now_us and buffered_ms wait for the consumer with it.
+  void Update(int64_t src_us,
+              int64_t now_us,
+              int     buffered_ms);
+
+  // > 0 when the source clock runs fast.
+  int  DriftPpm() const;
+
+  // Resampling of the source, > 0 makes more samples.
+  int  CompensationPpm() const;
+
+private:
+  const int target_ms_;
+
+  // lateness of a block is local time since t0_us_ less source time since
+  // src0_us_, its lowest per window gives the drift from window to window
+  bool    started_;
+  int64_t src0_us_;
+  int64_t t0_us_;
+  int64_t last_src_us_;
+  int64_t window_us_;
+  int64_t window_min_;
+  bool    have_min_;
+  int64_t prev_min_;
+  int64_t prev_us_;
+  bool    have_prev_;
+
+  double drift_ppm_;
+  bool   have_drift_;
+  double level_ms_; // smoothed buffered_ms
+  bool   have_level_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(AudioDriftEstimator);
+};
+} // namespace gang
@@ -0,0 +1,68 @@
+#include "gang_audio_mix.h"
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h>
+#endif // if defined(__SSE2__)
+
+namespace gang {
+namespace {
+inline int16_t Saturate(int32_t v) {
+  return v > INT16_MAX ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : static_cast<int16_t>(v));
+}
+} // namespace
+
+int GainFromFloat(float gain) {
+  if (gain <= 0) return 0;
+
+  return gain * kUnityGain >= kMaxGain ? kMaxGain : static_cast<int>(gain * kUnityGain + 0.5f);
+}
+
+void MixS16(int16_t *dst, const int16_t *src, size_t n, int gain) {
+  size_t i = 0;
+
+#if defined(__SSE2__)
+
+  if (gain == kUnityGain) {
+    for (; i + 8 <= n; i += 8) {
+      __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+      __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_adds_epi16(d, s));
+    }
+  } else {
+    const __m128i g = _mm_set1_epi16(static_cast<int16_t>(gain));
+
+    for (; i + 8 <= n; i += 8) {
+      __m128i d  = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+      __m128i s  = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+      __m128i lo = _mm_mullo_epi16(s, g);
+      __m128i hi = _mm_mulhi_epi16(s, g);
+
+      // 32 bit products, scaled back and packed with saturation.
+      __m128i p0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), kGainBits);
+      __m128i p1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), kGainBits);
+
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                       _mm_adds_epi16(d, _mm_packs_epi32(p0, p1)));
+    }
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  const int16x4_t g = vdup_n_s16(static_cast<int16_t>(gain));
+
+  for (; i + 8 <= n; i += 8) {
+    int16x8_t s  = vld1q_s16(src + i);
+    int32x4_t p0 = vshrq_n_s32(vmull_s16(vget_low_s16(s), g), kGainBits);
+    int32x4_t p1 = vshrq_n_s32(vmull_s16(vget_high_s16(s), g), kGainBits);
+
+    vst1q_s16(dst + i, vqaddq_s16(vld1q_s16(dst + i),
+                                  vcombine_s16(vqmovn_s32(p0), vqmovn_s32(p1))));
+  }
+#endif // if defined(__SSE2__)
+
+  for (; i < n; i++) {
+    dst[i] = Saturate(dst[i] + Saturate((src[i] * gain) >> kGainBits));
+  }
+}
+} // namespace gang
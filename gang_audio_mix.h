@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace gang {
+// Gains are fixed point with kGainBits fraction bits, kUnityGain is 1.0
+// and the largest one a bit under 2.0.
+enum {
+  kGainBits  = 14,
+  kUnityGain = 1 << kGainBits,
+  kMaxGain   = 32767
+};
+
+int  GainFromFloat(float gain);
+
+// dst[i] += src[i] * gain for n interleaved S16 samples, both the scaled
+// sample and the sum saturate. SSE2 or NEON when built for it.
+void MixS16(int16_t       *dst,
+            const int16_t *src,
+            size_t         n,
+            int            gain);
+} // namespace gang
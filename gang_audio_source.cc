@@ -0,0 +1,144 @@
+#include "gang_audio_source.h"
+
+#include <string.h>
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libswresample/swresample.h>
+}
+
+#include "webrtc/base/timeutils.h"
+
+#include "gang_audio_mix.h"
+#include "gang_spdlog_console.h"
+
+namespace gang {
+namespace {
+// ring_ is held at kTargetBufferMs against network jitter. Beyond
+// kMaxBufferMs it is too late to resample back, the excess is dropped.
+const int kTargetBufferMs = 60;
+const int kMaxBufferMs    = 250;
+} // namespace
+
+GangAudioSource::GangAudioSource(shared_ptr<GangDecoder> decoder,
+                                 uint32_t                sample_rate,
+                                 uint8_t                 channels) :
+  decoder_(decoder),
+  sample_rate_(sample_rate),
+  channels_(channels),
+  block_bytes_(sample_rate / 100 * 2 * channels),
+  in_sample_rate_(0),
+  in_channels_(0),
+  swr_(NULL),
+  ring_(kRingBlocks10ms * block_bytes_),
+  flush_(false),
+  drift_(kTargetBufferMs),
+  reset_drift_(false),
+  comp_ppm_(0),
+  gain_(kUnityGain) {
+  memset(dec_buff_, 0, kMaxBufferSizeBytes);
+}
+
+GangAudioSource::~GangAudioSource() {
+  swr_free(&swr_);
+}
+
+bool GangAudioSource::Init() {
+  decoder_->GetAudioInfo(&in_sample_rate_, &in_channels_);
+
+  if (!in_sample_rate_ || (in_channels_ < 1) || (in_channels_ > 2)) {
+    console->warn("{}: no usable audio, rate {} channels {}", __func__,
+                  in_sample_rate_, static_cast<int>(in_channels_));
+    return false;
+  }
+
+  if ((in_sample_rate_ == sample_rate_) && (in_channels_ == channels_)) {
+    return true;
+  }
+  swr_ = swr_alloc_set_opts(NULL,
+                            av_get_default_channel_layout(channels_), AV_SAMPLE_FMT_S16, sample_rate_,
+                            av_get_default_channel_layout(in_channels_), AV_SAMPLE_FMT_S16, in_sample_rate_,
+                            0, NULL);
+
+  if (!swr_ || (swr_init(swr_) < 0)) {
+    console->error("{}: could not convert {}Hz/{} to the mix", __func__,
+                   in_sample_rate_, static_cast<int>(in_channels_));
+    swr_free(&swr_);
+    return false;
+  }
+  SPDLOG_DEBUG(console, "{}: convert {}Hz/{} to {}Hz/{}", __func__,
+               in_sample_rate_, static_cast<int>(in_channels_),
+               sample_rate_, static_cast<int>(channels_))
+  return true;
+}
+
+void GangAudioSource::Start() {
+  // Process() owns the read side.
+  flush_       = true;
+  reset_drift_ = true;
+  decoder_->SetAudioFrameObserver(this, dec_buff_);
+}
+
+void GangAudioSource::Stop() {
+  decoder_->SetAudioFrameObserver(NULL, NULL);
+}
+
+void GangAudioSource::Prepare() {
+  if (flush_.exchange(false)) {
+    ring_.Skip(ring_.Size());
+  }
+
+  if (BufferedMs() > kMaxBufferMs) {
+    SPDLOG_DEBUG(console, "{}: {} ms behind, skip to {} ms", __func__, BufferedMs(), kTargetBufferMs)
+    ring_.Skip(ring_.Size() - kTargetBufferMs / 10 * block_bytes_);
+  }
+}
+
+bool GangAudioSource::Read(int16_t *block) {
+  return ring_.Read(reinterpret_cast<uint8_t *>(block), block_bytes_);
+}
+
+int GangAudioSource::BufferedMs() const {
+  return static_cast<int>(ring_.Size() * 10 / block_bytes_);
+}
+
+void GangAudioSource::SetGain(float gain) {
+  gain_.store(GainFromFloat(gain), std::memory_order_relaxed);
+}
+
+void GangAudioSource::OnGangFrame() {
+  const uint8_t *data = dec_buff_;
+  size_t         len  = in_sample_rate_ / 100 * 2 * in_channels_;
+
+  if (swr_) {
+    const size_t frame_bytes = 2 * channels_;
+    uint8_t     *out         = conv_buff_;
+    int          n           = swr_convert(swr_, &out, sizeof(conv_buff_) / frame_bytes,
+                                           &data, in_sample_rate_ / 100);
+
+    if (n < 0) {
+      SPDLOG_TRACE(console, "{} {}", __func__, "convert error")
+      return;
+    }
+    data = conv_buff_;
+    len  = n * frame_bytes;
+  }
+
+  if (!ring_.Write(data, len)) {
+    SPDLOG_TRACE(console, "{} {}", __func__, "ring overrun")
+  }
+
+  if (reset_drift_.exchange(false)) {
+    drift_.Reset();
+  }
+  drift_.Update(decoder_->GetAudioTime(), rtc::TimeNanos() / rtc::kNumNanosecsPerMicrosec, BufferedMs());
+
+  int ppm = drift_.CompensationPpm();
+
+  if (ppm != comp_ppm_) {
+    SPDLOG_TRACE(console, "{}: drift {} ppm, compensation {} ppm", __func__, drift_.DriftPpm(), ppm)
+    comp_ppm_ = ppm;
+    decoder_->SetAudioCompensation(ppm);
+  }
+}
+} // namespace gang
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include "webrtc/base/constructormagic.h"
+#include "gang_audio_drift.h"
+#include "gang_decoder.h"
+#include "gang_pcm_ring.h"
+
+struct SwrContext;
+
+namespace gang {
+using std::shared_ptr;
+
+const uint32_t kMaxBufferSizeBytes = 3840; // 10ms in stereo @ 96kHz
+const size_t   kRingBlocks10ms     = 50;   // 500ms between gang and webrtc
+
+// Audio of one decoder on its way to the mix of a GangAudioDevice,
+// converted to the mix format and queued in a ring. Its own drift
+// compensation holds the ring at the same level as every other source, so
+// all of them line up on the clock of the consumer.
+class GangAudioSource : public GangFrameObserver {
+public:
+  // Mix format, S16 interleaved.
+  GangAudioSource(shared_ptr<GangDecoder> decoder,
+                  uint32_t                sample_rate,
+                  uint8_t                 channels);
+  ~GangAudioSource();
+
+  // return: false when the audio of the decoder can not be converted
+  bool Init();
+
+  // Observe the decoder, dropping what is left from last time.
+  void Start();
+  void Stop();
+
+  // Consumer. Drop a pending flush or a backlog too old to resample away.
+  void Prepare();
+
+  // Consumer. Exactly one 10ms block of the mix format, or nothing.
+  bool Read(int16_t *block);
+
+  // Audio waiting in the ring, from either thread.
+  int  BufferedMs() const;
+
+  // 1.0 is unity, up to 2.0. Can be called from any thread.
+  void SetGain(float gain);
+  int  Gain() const {return gain_.load(std::memory_order_relaxed);}
+
+  // Called on the gang thread, queues the converted 10ms block.
+  virtual void OnGangFrame() override;
+
+private:
+  shared_ptr<GangDecoder> decoder_;
+  const uint32_t          sample_rate_;
+  const uint8_t           channels_;
+  const size_t            block_bytes_;     // 10ms of the mix format
+  uint32_t                in_sample_rate_;
+  uint8_t                 in_channels_;
+
+  // dec_buff_ is filled by the decoder, converted into conv_buff_ when the
+  // format differs from the mix.
+  uint8_t     dec_buff_[kMaxBufferSizeBytes];
+  uint8_t     conv_buff_[2 * kMaxBufferSizeBytes];
+  SwrContext *swr_;
+  PcmRing     ring_;
+
+  std::atomic<bool> flush_;
+
+  // gang thread only, reset_drift_ asks it to start over
+  AudioDriftEstimator drift_;
+  std::atomic<bool>   reset_drift_;
+  int                 comp_ppm_;
+
+  std::atomic<int> gain_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(GangAudioSource);
+};
+} // namespace gang
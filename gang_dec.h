@@ -5,11 +5,58 @@ extern "C" {
 #endif // ifdef __cplusplus
 
 #include <stdint.h>
+#include <pthread.h>
 #include <libavcodec/avcodec.h>
 #include <libavfilter/avfiltergraph.h>
 #include <libavformat/avformat.h>
 #include <libavutil/frame.h>
 
+#include "ffmpeg_audio_chunker.h"
+#include "ffmpeg_gop_cache.h"
+#include "ffmpeg_packet_queue.h"
+
+#define GANG_MAX_RENDITIONS 4
+
+// How much of the video the consumers want decoded.
+typedef enum GangVideoDemand {
+  GANG_DEMAND_ALL, // every frame
+  GANG_DEMAND_REF  // frames others refer to, non-reference ones are skipped
+} GangVideoDemand;
+
+// What a transcoded recording makes of silent stretches of audio.
+typedef enum GangSilenceMode {
+  GANG_SILENCE_ENCODE, // encode them like any audio
+  GANG_SILENCE_DROP,   // leave them out, the track has gaps
+  GANG_SILENCE_DTX     // empty Opus frames, concealed as silence on playback
+} GangSilenceMode;
+
+// Opus application of the recording encoder.
+typedef enum GangOpusApplication {
+  GANG_OPUS_DEFAULT, // keep the encoder default
+  GANG_OPUS_AUDIO,   // music or mixed content
+  GANG_OPUS_VOIP,    // speech
+  GANG_OPUS_LOWDELAY // least delay, CELT only
+} GangOpusApplication;
+
+// Encoder settings of recorded audio, 0 or -1 keep the encoder default.
+typedef struct GangAudioProfile {
+  int   bit_rate;       // bits/s, 0
+  int   complexity;     // 0 to 10, -1
+  int   application;    // GangOpusApplication, GANG_OPUS_DEFAULT
+  int   dtx;            // silence as empty frames, see GANG_SILENCE_DTX
+  float frame_duration; // ms of a frame, 2.5 to 60, 0
+} GangAudioProfile;
+
+// A scaled copy of the video split off the same decode.
+typedef struct GangRendition {
+  int              width;
+  int              height;
+  int              buff_size; // of a copied I420 frame
+  AVFilterContext *buffersink_ctx;
+  AVFrame         *frame;     // latest output, handed out by ref when ready
+  int              ready;
+} GangRendition;
+
 typedef struct FilterStreamContext {
   int              is_video;
   char            *filter_spec;
@@ -19,12 +66,27 @@ typedef struct FilterStreamContext {
   AVStream        *os;
   AVStream        *is;
   enum AVCodecID   enc_id;
+  int              copy; // recorded by packet copy, os has no encoder
+
+  // filtered output format, taken by both delivery and the encoder
+  enum AVPixelFormat  pix_fmt;
+  int                 width;
+  int                 height;
+  enum AVSampleFormat sample_fmt;
+  int                 sample_rate;
+  int                 channels;
+  uint64_t            channel_layout;
+
+  // extra video outputs split off after filter_spec
+  GangRendition *renditions;
+  int            nb_renditions;
 } FilterStreamContext;
 
 typedef struct gang_decoder {
   char *url;
   char *rec_name;
   int   rec_enabled;
+  int   rec_copy; // prefer writing input packets over transcoding
   int   audio_off;
   int   no_video;
   int   no_audio;
@@ -37,17 +99,97 @@ typedef struct gang_decoder {
   int                fps;
   enum AVPixelFormat pix_fmt;
 
+  // as decoded, before out_* scaled it at open
+  int src_width;
+  int src_height;
+  int src_fps;
+
+  // video output asked by the consumer, 0 keeps the source value
+  // filter_fps is set when the filter graph limits the rate, filter_key_only
+  // when the graph was built for key only output without the limit
+  int out_width;
+  int out_height;
+  int out_fps;
+  int filter_fps;
+  int filter_key_only;
+
+  // consumer demand for the next frames, a GangVideoDemand, and whether the
+  // next decoded video frame is wanted at all. video_discard is the
+  // skip_frame of the video decoder that follows the demand.
+  int            video_demand;
+  int            video_skip;
+  enum AVDiscard video_discard;
+
+  // only keyframes reach the video decoder, key_wait keeps dropping until
+  // the next one after key_only is turned off
+  int key_only;
+  int key_wait;
+
+  // video packets are not decoded while nothing consumes them. Once they
+  // are again, the cached GOP is fed from resume_pos over several steps and
+  // resume_index is the fscs index of the packet waiting for it, else -1.
+  int video_idle;
+  int resume_pos;
+  int resume_index;
+
+  // fscs index whose decoder may still hold frames of the last packet,
+  // -1 when the next step reads a packet
+  int drain_index;
+
+  // fscs index of the next decoder flushed once the input ended, -1 while
+  // there is input
+  int flush_index;
+
+  // threads of the video decoder, 0 for one per core, slice threaded and
+  // frame threaded only with video_frame_threads
+  int video_threads;
+  int video_frame_threads;
+
   // audio
   int sample_rate;
   int channels;
   int bytes_per_sample;
 
   // video decode buff
-  uint8_t *video_buff;
+  // video_by_ref hands out refs of video_frame, sinks copy them with
+  // gang_copy_video_frame
+  int      video_by_ref;
+  AVFrame *video_frame;
   uint8_t *audio_buff;
   int      video_buff_size;
   int      audio_buff_size;
 
+  // audio converted for delivery in audio_block samples (10ms) and for
+  // the recording encoder, without a filter graph
+  AudioChunker audio_chunker;
+  int          audio_block;
+
+  // drift compensation asked for the delivered audio, and the source time
+  // of the block last delivered in us
+  int     audio_comp_ppm;
+  int64_t audio_time;
+
+  // level of the converted audio in dBFS, published per level_window
+  // samples, level_ready until gang_decoder_audio_level takes it.
+  // level_wanted decodes audio for the level alone.
+  int level_wanted;
+  int level_window;
+  int level_rms;
+  int level_peak;
+  int level_ready;
+
+  // rec_silence is a GangSilenceMode for recorded audio under
+  // silence_dbfs, silent_ms long so far
+  int rec_silence;
+  int silence_dbfs;
+  int silent_ms;
+
+  GangAudioProfile audio_profile;
+
+  // scaled renditions of the video, numbered from 1, 0 is the main output
+  GangRendition renditions[GANG_MAX_RENDITIONS];
+  int           nb_renditions;
+
   AVFormatContext     *ifmt_ctx;
   AVFormatContext     *ofmt_ctx;
   FilterStreamContext *fscs;
@@ -57,6 +199,32 @@ typedef struct gang_decoder {
   AVPacket o_pkt;
   AVFrame *i_frame;
   AVFrame *o_frame;
+
+  // input I/O is interrupted by abort_request or once io_deadline
+  // (av_gettime_relative) passes, armed from the timeouts per operation
+  AVIOInterruptCB io_cb;
+  int             open_timeout_ms;
+  int             read_timeout_ms;
+  int64_t         io_deadline;
+  int             abort_request;
+
+  // pipelined demuxing, 0 pkt_queue_size means reading on the decode thread
+  // read_wait_ms bounds the wait of the decode thread for a queued packet
+  int         pkt_queue_size;
+  int         pkt_queue_policy;
+  int         read_wait_ms;
+  int         reading;
+  PacketQueue pkt_queue;
+  pthread_t   read_thread;
+
+  // input probed by init_gang_av_info, kept open for open_gang_decoder
+  // until warm_deadline (av_gettime_relative), 0 when not warm
+  int     keep_warm_ms;
+  int64_t warm_deadline;
+
+  // packets since the last video keyframe, 0 gop_cache_size disables it
+  int      gop_cache_size;
+  GopCache gop_cache;
 } gang_decoder;
 
 #ifdef __cplusplus
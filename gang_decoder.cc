@@ -1,20 +1,27 @@
 #include "gang_decoder.h"
 
+#include <algorithm>
 #include <memory>
-#include "webrtc/base/bind.h"
+
+#include "webrtc/base/timeutils.h"
 
 #include "gang_spdlog_console.h"
 #include "gang_decoder_impl.h"
 
 namespace gang {
-using rtc::Bind;
+namespace {
+// Packet queue of pooled decoders, which can not read on their own thread.
+const int kStrandPktQueueSize = 64;
+
+// GOP cache of lingering decoders that have none set.
+const int kLingerGopCache = 300;
+} // namespace
 
 // Take from "talk/media/devices/yuvframescapturer.h"
-class GangDecoder::GangThread : public Thread, public rtc::MessageHandler {
+class GangDecoder::GangThread : public Thread {
 public:
   explicit GangThread(GangDecoder *dec) :
     dec_(dec),
-    waiting_time_ms_(0),
     finished_(false) {}
 
   virtual ~GangThread() {
@@ -35,64 +42,6 @@ public:
     finished_ = true;
   }
 
-  // Override virtual method of parent MessageHandler. Context: Worker Thread.
-  virtual void OnMessage(rtc::Message *pmsg) {
-    if (dec_) {
-      switch (pmsg->message_id) {
-        case NEXT:
-          if (dec_->connected_ && dec_->NextFrameLoop()) {
-            PostDelayed(waiting_time_ms_, this, NEXT);
-          } else if (dec_->connected_) {
-            dec_->Stop(true);
-          }
-          break;
-
-        case REC_ON:
-          dec_->SetRecOn(static_cast<RecOnMsgData *>(pmsg->pdata)->data());
-          break;
-
-        case VIDEO_START: {
-          rtc::scoped_ptr<ObserverMsgData> data(
-            static_cast<ObserverMsgData *>(pmsg->pdata));
-          dec_->StartVideoCapture_g(data->data()->observer, data->data()->buff);
-          break;
-        }
-
-        case VIDEO_STOP: {
-          rtc::scoped_ptr<ObserverMsgData> data(
-            static_cast<ObserverMsgData *>(pmsg->pdata));
-          dec_->StopVideoCapture_g(data->data()->observer);
-          break;
-        }
-
-        case AUDIO_OBSERVER: {
-          rtc::scoped_ptr<ObserverMsgData> data(
-            static_cast<ObserverMsgData *>(pmsg->pdata));
-          dec_->SetAudioObserver_g(data->data()->observer, data->data()->buff);
-          break;
-        }
-
-        case START_REC:
-          dec_->Start();
-          break;
-
-        case SHUTDOWN:
-          SPDLOG_TRACE(console, "{} SHUTDOWN", __func__)
-          if (dec_->connected_) dec_->stop();
-          Clear(this);
-          Quit();
-          SPDLOG_TRACE(console, "{} SHUTDOWN ok", __func__)
-          break;
-
-        default:
-          console->error("{} {}", __func__, "unexpected msg type");
-          break;
-      }
-    } else {
-      Quit();
-    }
-  }
-
   // Check if Run() is finished.
   bool Finished() const {
     rtc::CritScope cs(&crit_);
@@ -102,7 +51,7 @@ public:
 
 private:
   GangDecoder                 *dec_;
-  int                          waiting_time_ms_;bool finished_;
+  bool                         finished_;
   mutable rtc::CriticalSection crit_;
 
   RTC_DISALLOW_COPY_AND_ASSIGN(GangThread);
@@ -114,29 +63,55 @@ GangDecoder::GangDecoder(const std::string& id,
                          bool               rec_on,
                          bool               audio_off,
                          Thread            *worker_thread,
-                         StatusObserver    *status_observer) :
+                         StatusObserver    *status_observer,
+                         GangScheduler     *scheduler) :
   connected_(false),
   id_(id),
   decoder_(::new_gang_decoder(url.c_str(), rec_name.c_str(), rec_on,
                               audio_off)),
-  gang_thread_(new GangThread(this)),
+  gang_thread_(scheduler ? NULL : new GangThread(this)),
+  strand_(scheduler ? scheduler->CreateStrand(this) : std::shared_ptr<GangStrand>()),
   worker_thread_(worker_thread),
-  video_frame_observer_(NULL),
+  opening_(false),
+  open_err_(0),
   audio_frame_observer_(NULL),
-  status_observer_(status_observer) {
-  gang_thread_->Start();
+  status_observer_(status_observer),
+  level_observer_(NULL),
+  linger_ms_(0) {
+  if (gang_thread_) {
+    gang_thread_->Start();
+  } else if (decoder_) {
+    // A worker must not block on the network. Demuxers only read blocking,
+    // so each pooled decoder keeps a reader thread, mostly asleep in its
+    // socket, and the strand takes what is already queued. The reader
+    // wakes the strand, see OnInput.
+    ::set_gang_decoder_pkt_queue(decoder_, kStrandPktQueueSize, PKT_QUEUE_BLOCK);
+    ::set_gang_decoder_read_wait(decoder_, 0);
+    ::set_gang_decoder_threads(decoder_, 1, 0);
+  }
   SPDLOG_TRACE(console, "{}: url: {}, rec_name: {}", __func__, url, rec_name)
 }
 
 GangDecoder::~GangDecoder() {
   SPDLOG_TRACE(console, "{}", __func__)
 
+  // Do not let a blocked read or open hold up the shutdown.
+  if (decoder_) {
+    ::abort_gang_decoder(decoder_);
+  }
+
   if (gang_thread_) {
-    gang_thread_->Post(gang_thread_, SHUTDOWN);
+    gang_thread_->Post(this, SHUTDOWN);
     delete gang_thread_;
     gang_thread_ = NULL;
   }
 
+  if (strand_) {
+    strand_->Post(SHUTDOWN);
+    strand_->Stop();
+    strand_.reset();
+  }
+
   if (decoder_) {
     ::free_gang_decoder(decoder_);
     decoder_ = NULL;
@@ -147,10 +122,19 @@ GangDecoder::~GangDecoder() {
 void GangDecoder::Shutdown() {
   SPDLOG_TRACE(console, "{}", __func__)
 
+  if (decoder_) {
+    ::abort_gang_decoder(decoder_);
+  }
+
   if (gang_thread_) {
-    gang_thread_->Post(gang_thread_, SHUTDOWN);
+    gang_thread_->Post(this, SHUTDOWN);
     gang_thread_->Stop();
   }
+
+  if (strand_) {
+    strand_->Post(SHUTDOWN);
+    strand_->Stop();
+  }
   SPDLOG_TRACE(console, "{} {}", __func__, "ok")
 }
 
@@ -158,7 +142,15 @@ bool GangDecoder::Init() {
   if (!decoder_ || !worker_thread_) {
     return false;
   }
-  return !::init_gang_av_info(decoder_);
+
+  if (::init_gang_av_info(decoder_)) {
+    return false;
+  }
+
+  if (decoder_->keep_warm_ms) {
+    PostGangDelayed(decoder_->keep_warm_ms, RELEASE_WARM);
+  }
+  return true;
 }
 
 bool GangDecoder::IsVideoAvailable() {
@@ -189,11 +181,162 @@ void GangDecoder::GetVideoInfo(int    *width,
   *buf_size = static_cast<uint32>(decoder_->video_buff_size);
 }
 
+void GangDecoder::GetSourceVideoInfo(int *width, int *height, int *fps) {
+  *width  = decoder_->src_width;
+  *height = decoder_->src_height;
+  *fps    = decoder_->src_fps;
+}
+
+void GangDecoder::SetPacketQueue(int size, int policy) {
+  // Pooled decoders always read through a queue, see the constructor.
+  ::set_gang_decoder_pkt_queue(decoder_, strand_ && size <= 0 ? kStrandPktQueueSize : size, policy);
+}
+
+void GangDecoder::GetPacketQueueStats(int *occupancy, int64_t *dropped) {
+  *occupancy = ::gang_pkt_queue_occupancy(decoder_);
+  *dropped   = ::gang_pkt_queue_dropped(decoder_);
+}
+
+int GangDecoder::AddRendition(int width, int height) {
+  return ::add_gang_decoder_rendition(decoder_, width, height);
+}
+
+bool GangDecoder::GetRenditionInfo(int     rendition,
+                                   int    *width,
+                                   int    *height,
+                                   uint32 *buf_size) {
+  if ((rendition <= 0) || (rendition > decoder_->nb_renditions)) {
+    return false;
+  }
+  const GangRendition& r = decoder_->renditions[rendition - 1];
+
+  *width    = r.width;
+  *height   = r.height;
+  *buf_size = static_cast<uint32>(r.buff_size);
+  return true;
+}
+
 void GangDecoder::GetAudioInfo(uint32_t *sample_rate, uint8_t *channels) {
   *sample_rate = static_cast<uint32_t>(decoder_->sample_rate);
   *channels    = static_cast<uint8_t>(decoder_->channels);
 }
 
+void GangDecoder::OnMessage(rtc::Message *pmsg) {
+  switch (pmsg->message_id) {
+    case NEXT:
+      if (connected_ && NextFrameLoop()) {
+        // A pooled decoder does not wait for input, the reader posts NEXT.
+        if (!strand_ || !::gang_decoder_arm_input(decoder_, &GangDecoder::OnInput, this)) {
+          PostGang(NEXT);
+        }
+      } else if (connected_) {
+        Stop(true);
+      }
+      break;
+
+    case REC_ON:
+      SetRecOn(static_cast<RecOnMsgData *>(pmsg->pdata)->data());
+      break;
+
+    case VIDEO_START: {
+      rtc::scoped_ptr<ObserverMsgData> data(
+        static_cast<ObserverMsgData *>(pmsg->pdata));
+      StartVideoCapture_g(data->data()->observer, data->data()->buff, data->data()->buff_size,
+                          data->data()->rendition);
+      break;
+    }
+
+    case VIDEO_STOP: {
+      rtc::scoped_ptr<ObserverMsgData> data(
+        static_cast<ObserverMsgData *>(pmsg->pdata));
+      StopVideoCapture_g(data->data()->observer);
+      break;
+    }
+
+    case VIDEO_FPS: {
+      rtc::scoped_ptr<ObserverMsgData> data(
+        static_cast<ObserverMsgData *>(pmsg->pdata));
+      SetVideoFrameRate_g(data->data()->observer, data->data()->fps);
+      break;
+    }
+
+    case VIDEO_FORMAT: {
+      rtc::scoped_ptr<VideoFormatMsgData> data(
+        static_cast<VideoFormatMsgData *>(pmsg->pdata));
+      SetVideoFormat_g(data->data());
+      break;
+    }
+
+    case AUDIO_OBSERVER: {
+      rtc::scoped_ptr<ObserverMsgData> data(
+        static_cast<ObserverMsgData *>(pmsg->pdata));
+      SetAudioObserver_g(data->data()->observer, data->data()->buff);
+      break;
+    }
+
+    case START_REC:
+      Start();
+      break;
+
+    case RELEASE_WARM:
+      ::release_gang_warm_input(decoder_, 0);
+      break;
+
+    case OPENED:
+      Opened(open_err_);
+      break;
+
+    case LINGER_END:
+      if (video_sinks_.empty() && !audio_frame_observer_) {
+        SPDLOG_TRACE(console, "{}: linger of {} ms is over", __func__, linger_ms_)
+        Stop(false);
+      }
+      break;
+
+    case SHUTDOWN:
+      SPDLOG_TRACE(console, "{} SHUTDOWN", __func__)
+      if (connected_) stop();
+      else ::release_gang_warm_input(decoder_, 1);
+      ClearGang(rtc::MQID_ANY);
+
+      if (strand_) strand_->Quit();
+      else gang_thread_->Quit();
+      SPDLOG_TRACE(console, "{} SHUTDOWN ok", __func__)
+      break;
+
+    default:
+      console->error("{} {}", __func__, "unexpected msg type");
+      break;
+  }
+}
+
+void GangDecoder::PostGang(uint32 id, rtc::MessageData *data) {
+  if (strand_) strand_->Post(id, data);
+  else gang_thread_->Post(this, id, data);
+}
+
+void GangDecoder::PostGangDelayed(int cms, uint32 id) {
+  if (strand_) strand_->PostDelayed(cms, id);
+  else gang_thread_->PostDelayed(cms, this, id);
+}
+
+void GangDecoder::ClearGang(uint32 id) {
+  if (strand_) strand_->Clear(id);
+  else gang_thread_->Clear(this, id);
+}
+
+void GangDecoder::OnInput(void *opaque) {
+  static_cast<GangDecoder *>(opaque)->PostGang(NEXT);
+}
+
+bool GangDecoder::IsGangCurrent() const {
+  return strand_ ? strand_->IsCurrent() : gang_thread_->IsCurrent();
+}
+
+bool GangDecoder::GangFinished() const {
+  return strand_ ? strand_->IsQuitting() : gang_thread_->Finished();
+}
+
 void GangDecoder::stop() {
   connected_ = false;
   ::flush_gang_rec_encoder(decoder_);
@@ -202,126 +345,275 @@ void GangDecoder::stop() {
 }
 
 bool GangDecoder::Start() {
-  DCHECK(gang_thread_->IsCurrent());
+  DCHECK(IsGangCurrent());
   SPDLOG_TRACE(console, "{}", __func__)
 
-  if (gang_thread_->Finished()) {
+  if (GangFinished()) {
     return false;
   }
 
-  if (!connected_) {
-    connected_ = !::open_gang_decoder(decoder_);
-
-    if (connected_) {
-      SendStatus(Alive);
-    } else {
-      SendStatus(Dead);
-    }
+  if (!connected_ && strand_) {
+    // An open waits on the network for up to the open timeout, so a pooled
+    // decoder opens on a blocking thread and goes on at OPENED.
+    strand_->Offload([this] {
+      open_err_ = ::open_gang_decoder(decoder_);
+    }, OPENED);
+    opening_ = true;
+    return true;
   }
 
   if (!connected_) {
-    return false;
+    Opened(::open_gang_decoder(decoder_));
+    return connected_;
   }
-  gang_thread_->Clear(gang_thread_, NEXT);
-  gang_thread_->PostDelayed(0, gang_thread_, NEXT);
+  ClearGang(LINGER_END);
+  ClearGang(NEXT);
+  PostGang(NEXT);
   return true;
 }
 
+void GangDecoder::Opened(int err) {
+  DCHECK(IsGangCurrent());
+  opening_   = false;
+  connected_ = !err;
+
+  if (connected_) {
+    SendStatus(Alive);
+    ClearGang(LINGER_END);
+    ClearGang(NEXT);
+    PostGang(NEXT);
+  } else {
+    SendStatus(Dead);
+  }
+
+  for (auto observer : started_observers_) observer->OnVideoStarted(connected_);
+  started_observers_.clear();
+}
+
 void GangDecoder::Stop(bool force) {
-  DCHECK(gang_thread_->IsCurrent());
+  DCHECK(IsGangCurrent());
   SPDLOG_TRACE(console, "{}: {}", __func__, force)
 
   if (!force && decoder_->rec_enabled) {
     return;
   }
   stop();
-  gang_thread_->Clear(gang_thread_, NEXT);
+  ClearGang(NEXT);
   SPDLOG_TRACE(console, "{}: {}", __func__, "ok")
 }
 
 // return true->continue, false->end
 bool GangDecoder::NextFrameLoop() {
-  DCHECK(gang_thread_->IsCurrent());
+  int rms;
+  int peak;
 
-  switch (::gang_decode_next_frame(decoder_)) {
-    case GANG_VIDEO_DATA:
-      if (video_frame_observer_) {
-        video_frame_observer_->OnGangFrame();
-      }
-      break;
+  DCHECK(IsGangCurrent());
 
-    case GANG_AUDIO_DATA:
-      if (audio_frame_observer_) {
-        worker_thread_->Invoke<void>(
-          Bind(&GangFrameObserver::OnGangFrame, audio_frame_observer_));
-      }
-      break;
+  // Hand out every frame the last packet decoded to before reading on.
+  do {
+    UpdateVideoDemand();
 
-    case GANG_FITAL: // end loop
-      SPDLOG_TRACE(console, "{}: {}", __func__, "GANG_FITAL")
-      SendStatus(Dead);
-      return false;
+    switch (::gang_decode_next_frame(decoder_)) {
+      case GANG_VIDEO_DATA:
+        DeliverVideoFrame();
+        break;
 
-    case GANG_ERROR_DATA: // ignore and next
-      break;
+      case GANG_AUDIO_DATA:
+        if (audio_frame_observer_) {
+          audio_frame_observer_->OnGangFrame();
+        }
+        break;
 
-    default:              // unexpected, so end loop
-      console->error() << "Unknow ret code from decoder!";
-      SendStatus(Dead);
-      return false;
-  }
+      case GANG_FITAL: // end loop
+        SPDLOG_TRACE(console, "{}: {}", __func__, "GANG_FITAL")
+        SendStatus(Dead);
+        return false;
+
+      case GANG_ERROR_DATA: // ignore and next
+        break;
+
+      default:              // unexpected, so end loop
+        console->error() << "Unknow ret code from decoder!";
+        SendStatus(Dead);
+        return false;
+    }
+
+    if (level_observer_ && ::gang_decoder_audio_level(decoder_, &rms, &peak)) {
+      level_observer_->OnAudioLevel(id_, rms, peak);
+    }
+  } while (::gang_decoder_draining(decoder_));
   return true;
 }
 
+// Tell the decoder what the sinks will take. The next frame is skipped
+// when no sink is due, non-reference frames when every sink wants at most
+// half the rate or when the reader is falling behind.
+void GangDecoder::UpdateVideoDemand() {
+  int64 n        = static_cast<int64>(rtc::TimeNanos());
+  int64 frame_ns = decoder_->fps > 0 ? rtc::kNumNanosecsPerSec / decoder_->fps : 0;
+  bool  due      = false;
+  bool  sparse   = !video_sinks_.empty();
+  int   demand   = GANG_DEMAND_ALL;
+
+  for (const auto& sink : video_sinks_) {
+    if (!sink.interval_ns || (n >= sink.next_ns)) due = true;
+
+    if (sink.interval_ns < 2 * frame_ns) sparse = false;
+  }
+
+  if ((sparse && frame_ns) ||
+      (decoder_->pkt_queue_size && (::gang_pkt_queue_occupancy(decoder_) > decoder_->pkt_queue_size / 2))) {
+    demand = GANG_DEMAND_REF;
+  }
+  ::set_gang_decoder_video_demand(decoder_, demand, !due);
+}
+
+// The decoder always hands out a ref of the frame, every sink sees the
+// same refcounted data and buff sinks get their own copy.
+void GangDecoder::DeliverVideoFrame() {
+  int64    n = static_cast<int64>(rtc::TimeNanos());
+  AVFrame *frame;
+  int      i;
+
+  for (auto& sink : video_sinks_) {
+    if (!sink.rendition) {
+      frame = decoder_->video_frame;
+    } else if (decoder_->renditions[sink.rendition - 1].ready) {
+      frame = decoder_->renditions[sink.rendition - 1].frame;
+    } else {
+      continue;
+    }
+
+    if (sink.interval_ns) {
+      if (n < sink.next_ns) continue;
+
+      // Keep the average rate over jitter, but do not burst after a pause.
+      sink.next_ns += sink.interval_ns;
+
+      if (sink.next_ns <= n) sink.next_ns = n + sink.interval_ns;
+    }
+
+    if (!sink.buff) {
+      sink.observer->OnGangVideoFrame(frame);
+    } else if (::gang_copy_video_frame(frame, sink.buff, sink.buff_size) >= 0) {
+      sink.observer->OnGangFrame();
+    }
+  }
+  av_frame_unref(decoder_->video_frame);
+
+  for (i = 0; i < decoder_->nb_renditions; i++) {
+    av_frame_unref(decoder_->renditions[i].frame);
+    decoder_->renditions[i].ready = 0;
+  }
+}
+
 // Called by webrtc worker thread
+// NULL buff means frames are delivered by ref to OnGangVideoFrame.
 void GangDecoder::StartVideoCapture(GangFrameObserver *observer,
-                                    uint8_t           *buff) {
+                                    uint8_t           *buff,
+                                    int                buff_size,
+                                    int                rendition) {
   DCHECK(observer);
-  DCHECK(buff);
-  gang_thread_->Post(
-    gang_thread_,
-    VIDEO_START,
-    new ObserverMsgData(new Observer(observer, buff)));
+  PostGang(VIDEO_START, new ObserverMsgData(new Observer(observer, buff, 0, rendition, buff_size)));
 }
 
 void GangDecoder::StartVideoCapture_g(GangFrameObserver *observer,
-                                      uint8_t           *buff) {
-  DCHECK(gang_thread_->IsCurrent());
-  video_frame_observer_ = observer;
-  decoder_->video_buff  = buff;
-  observer->OnVideoStarted(Start());
+                                      uint8_t           *buff,
+                                      int                buff_size,
+                                      int                rendition) {
+  DCHECK(IsGangCurrent());
+
+  if ((rendition < 0) || (rendition > decoder_->nb_renditions)) {
+    console->error("{}: no rendition {}", __func__, rendition);
+    observer->OnVideoStarted(false);
+    return;
+  }
+  auto it = std::find_if(video_sinks_.begin(), video_sinks_.end(),
+                         [observer](const VideoSink& sink) {
+    return sink.observer == observer;
+  });
+
+  if (it != video_sinks_.end()) {
+    it->buff      = buff;
+    it->buff_size = buff_size;
+    it->rendition = rendition;
+  } else {
+    video_sinks_.push_back(VideoSink(observer, buff, buff_size, rendition));
+  }
+  decoder_->video_by_ref = 1;
+  bool started = Start();
+
+  // Still opening, the observer hears back at OPENED.
+  if (opening_) started_observers_.push_back(observer);
+  else observer->OnVideoStarted(started);
 }
 
 // Called by webrtc worker thread
 void GangDecoder::StopVideoCapture(GangFrameObserver *observer) {
   DCHECK(observer);
-  gang_thread_->Post(gang_thread_, VIDEO_STOP,
-                     new ObserverMsgData(new Observer(observer, NULL)));
+  PostGang(VIDEO_STOP, new ObserverMsgData(new Observer(observer, NULL)));
 }
 
 void GangDecoder::StopVideoCapture_g(GangFrameObserver *observer) {
-  DCHECK(gang_thread_->IsCurrent());
-  video_frame_observer_ = NULL;
-  decoder_->video_buff  = NULL;
+  DCHECK(IsGangCurrent());
+  video_sinks_.erase(std::remove_if(video_sinks_.begin(), video_sinks_.end(),
+                                    [observer](const VideoSink& sink) {
+    return sink.observer == observer;
+  }), video_sinks_.end());
   observer->OnVideoStopped();
 
+  if (!video_sinks_.empty()) {
+    return;
+  }
+  decoder_->video_by_ref = 0;
+
   if (!audio_frame_observer_) {
-    Stop(false);
+    Linger();
+  }
+}
+
+// Can be called from any thread.
+void GangDecoder::SetVideoFrameRate(GangFrameObserver *observer, int max_fps) {
+  DCHECK(observer);
+  PostGang(VIDEO_FPS, new ObserverMsgData(new Observer(observer, NULL, max_fps)));
+}
+
+void GangDecoder::SetVideoFrameRate_g(GangFrameObserver *observer, int max_fps) {
+  DCHECK(IsGangCurrent());
+
+  for (auto& sink : video_sinks_) {
+    if (sink.observer != observer) continue;
+
+    sink.interval_ns = max_fps > 0 ? rtc::kNumNanosecsPerSec / max_fps : 0;
+    sink.next_ns     = 0;
+  }
+}
+
+void GangDecoder::SetVideoFormat(int width, int height, int fps) {
+  GangVideoFormat format = {width, height, fps};
+
+  PostGang(VIDEO_FORMAT, new VideoFormatMsgData(format));
+}
+
+void GangDecoder::SetVideoFormat_g(const GangVideoFormat& format) {
+  DCHECK(IsGangCurrent());
+
+  if (connected_) {
+    SPDLOG_TRACE(console, "{}: running, keep {}x{}", __func__, decoder_->width, decoder_->height)
+    return;
   }
+  ::set_gang_decoder_video_format(decoder_, format.width, format.height, format.fps);
 }
 
 // Called by webrtc worker thread
 void GangDecoder::SetAudioFrameObserver(GangFrameObserver *observer,
                                         uint8_t           *buff) {
-  gang_thread_->Post(
-    gang_thread_,
-    AUDIO_OBSERVER,
-    new ObserverMsgData(new Observer(observer, buff)));
+  PostGang(AUDIO_OBSERVER, new ObserverMsgData(new Observer(observer, buff)));
 }
 
 void GangDecoder::SetAudioObserver_g(GangFrameObserver *observer,
                                      uint8_t           *buff) {
-  DCHECK(gang_thread_->IsCurrent());
+  DCHECK(IsGangCurrent());
   audio_frame_observer_ = observer;
   decoder_->audio_buff  = buff;
 
@@ -330,29 +622,119 @@ void GangDecoder::SetAudioObserver_g(GangFrameObserver *observer,
     return;
   }
 
-  if (!video_frame_observer_) {
-    Stop(false);
+  if (video_sinks_.empty()) {
+    Linger();
   }
 }
 
-// TODO fix not to stop thread when toggle rec_enabled status.
 // Do not call in the running thread
 void GangDecoder::SetRecordEnabled(bool enabled) {
-  gang_thread_->Post(gang_thread_, REC_ON, new RecOnMsgData(enabled));
+  PostGang(REC_ON, new RecOnMsgData(enabled));
+}
+
+void GangDecoder::SetRecordCopy(bool copy) {
+  ::set_gang_decoder_rec_copy(decoder_, copy);
+}
+
+void GangDecoder::SetRecordSilence(GangSilenceMode mode, int dbfs) {
+  ::set_gang_decoder_rec_silence(decoder_, mode, dbfs);
+}
+
+void GangDecoder::SetAudioProfile(const GangAudioProfile& profile) {
+  ::set_gang_decoder_audio_profile(decoder_, &profile);
+}
+
+void GangDecoder::SetLevelObserver(LevelObserver *observer) {
+  level_observer_ = observer;
+  ::set_gang_decoder_level_wanted(decoder_, observer != NULL);
+}
+
+void GangDecoder::SetStatusObserver(StatusObserver *observer) {
+  status_observer_ = observer;
+}
+
+void GangDecoder::SetIoTimeout(int open_ms, int read_ms) {
+  ::set_gang_decoder_io_timeout(decoder_, open_ms, read_ms);
+}
+
+void GangDecoder::SetKeepWarm(int ms) {
+  ::set_gang_decoder_keep_warm(decoder_, ms);
+}
+
+void GangDecoder::SetDecoderThreads(int threads, bool frame_threads) {
+  ::set_gang_decoder_threads(decoder_, threads, frame_threads);
+}
+
+void GangDecoder::SetLinger(int ms) {
+  linger_ms_ = ms > 0 ? ms : 0;
+
+  // A returning viewer is primed from the cached GOP.
+  if (linger_ms_ && !decoder_->gop_cache_size) {
+    ::set_gang_decoder_gop_cache(decoder_, kLingerGopCache);
+  }
+}
+
+// The last observer left. Keep reading without decoding for linger_ms_,
+// Start in the meantime picks the input up as it is.
+void GangDecoder::Linger() {
+  DCHECK(IsGangCurrent());
+
+  if (!linger_ms_ || !connected_) {
+    Stop(false);
+    return;
+  }
+  SPDLOG_TRACE(console, "{}: {} ms", __func__, linger_ms_)
+  ClearGang(LINGER_END);
+  PostGangDelayed(linger_ms_, LINGER_END);
+}
+
+void GangDecoder::SetKeyFrameOnly(bool key_only) {
+  ::set_gang_decoder_key_only(decoder_, key_only);
+}
+
+bool GangDecoder::IsKeyFrameOnly() {
+  return ::gang_decoder_key_only(decoder_) != 0;
+}
+
+void GangDecoder::SetAudioCompensation(int ppm) {
+  ::set_gang_decoder_audio_compensation(decoder_, ppm);
+}
+
+int64_t GangDecoder::GetAudioTime() {
+  return ::gang_decoder_audio_time(decoder_);
+}
+
+void GangDecoder::SetGopCache(int max_pkts) {
+  ::set_gang_decoder_gop_cache(decoder_, max_pkts);
 }
 
 void GangDecoder::SetRecOn(bool enabled) {
-  DCHECK(gang_thread_->IsCurrent());
+  DCHECK(IsGangCurrent());
 
   if ((!decoder_->rec_enabled) == (!enabled)) {
     return;
   }
-  Stop(true);
   decoder_->rec_enabled = enabled;
 
-  if (enabled || video_frame_observer_ || audio_frame_observer_) {
-    SPDLOG_TRACE(console, "{} {}", __func__, "restart")
-    Start();
+  if (!connected_) {
+    if (enabled) {
+      SPDLOG_TRACE(console, "{} {}", __func__, "start")
+      Start();
+    }
+    return;
+  }
+
+  // Toggle only the muxer side, input and live observers keep running.
+  if (enabled) {
+    if (::start_gang_rec(decoder_)) {
+      console->error("{} {}", __func__, "start_gang_rec failed");
+    }
+    return;
+  }
+  ::stop_gang_rec(decoder_);
+
+  if (video_sinks_.empty() && !audio_frame_observer_) {
+    Stop(false);
   }
 }
 
@@ -364,7 +746,7 @@ void GangDecoder::SendStatus(GangStatus status) {
 
 void GangDecoder::StartRec() {
   if (decoder_->rec_enabled) {
-    gang_thread_->Post(gang_thread_, START_REC);
+    PostGang(START_REC);
   }
 }
 } // namespace gang
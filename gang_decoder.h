@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+
 #include "webrtc/base/basictypes.h"
 #include "webrtc/base/constructormagic.h"
 #include "webrtc/base/criticalsection.h"
@@ -7,6 +9,7 @@
 #include "talk/media/base/videocapturer.h"
 
 #include "gang_dec.h"
+#include "gang_scheduler.h"
 
 namespace gang {
 using rtc::Thread;
@@ -23,11 +26,26 @@ public:
   virtual ~StatusObserver() {}
 };
 
+// Audio level of a decoder per window while it runs, called on its gang
+// thread. Audio is decoded for it even without an audio observer.
+// dBFS, AUDIO_LEVEL_FLOOR_DBFS for digital silence.
+class LevelObserver {
+public:
+  virtual void OnAudioLevel(const std::string& id,
+                            int                rms_dbfs,
+                            int                peak_dbfs) = 0;
+  virtual ~LevelObserver() {}
+};
+
 // need be shared_ptr
 class GangFrameObserver {
 public:
   // see "talk/media/webrtc/webrtcvideoframe.h"
   virtual void OnGangFrame() = 0;
+
+  // Video started with a NULL buff. frame is only valid during the call,
+  // av_frame_clone it to keep the data without copying.
+  virtual void OnGangVideoFrame(const AVFrame *frame) {}
   virtual void OnVideoStarted(bool success) {}
 
   virtual void OnVideoStopped()             {}
@@ -37,20 +55,53 @@ public:
 
 class Observer {
 public:
-  Observer(GangFrameObserver *_observer, uint8_t *_buff) :
+  Observer(GangFrameObserver *_observer, uint8_t *_buff, int _fps = 0, int _rendition = 0, int _buff_size = 0) :
     observer(_observer),
-    buff(_buff) {}
+    buff(_buff),
+    fps(_fps),
+    rendition(_rendition),
+    buff_size(_buff_size) {}
 
   GangFrameObserver *observer;
   uint8_t           *buff;
+  int                fps;
+  int                rendition;
+  int                buff_size;
+};
+
+// One consumer of the decoded video, gang thread only.
+class VideoSink {
+public:
+  VideoSink(GangFrameObserver *_observer, uint8_t *_buff, int _buff_size, int _rendition) :
+    observer(_observer),
+    buff(_buff),
+    buff_size(_buff_size),
+    rendition(_rendition),
+    interval_ns(0),
+    next_ns(0) {}
+
+  GangFrameObserver *observer;
+  uint8_t           *buff;        // NULL takes frames by ref
+  int                buff_size;   // frames larger than this are skipped
+  int                rendition;   // 0 for the main output
+  int64              interval_ns; // 0 delivers every frame
+  int64              next_ns;
+};
+
+// Video output asked by a consumer, 0 keeps the source value.
+struct GangVideoFormat {
+  int width;
+  int height;
+  int fps;
 };
 
-typedef rtc::ScopedMessageData<Observer> ObserverMsgData;
-typedef rtc::TypedMessageData<bool>      RecOnMsgData;
+typedef rtc::ScopedMessageData<Observer>       ObserverMsgData;
+typedef rtc::TypedMessageData<GangVideoFormat> VideoFormatMsgData;
+typedef rtc::TypedMessageData<bool>            RecOnMsgData;
 
-class GangDecoder {
+class GangDecoder : public rtc::MessageHandler {
 public:
-  enum {NEXT, REC_ON, START_REC, SHUTDOWN, VIDEO_START, VIDEO_STOP, AUDIO_OBSERVER};
+  enum {NEXT, REC_ON, START_REC, SHUTDOWN, VIDEO_START, VIDEO_STOP, VIDEO_FPS, VIDEO_FORMAT, AUDIO_OBSERVER, RELEASE_WARM, LINGER_END, OPENED};
 
   explicit GangDecoder(
     const std::string& id,
@@ -59,22 +110,48 @@ public:
     bool               rec_enabled,
     bool               audio_off,
     Thread            *worker_thread,
-    StatusObserver    *status_observer);
+    StatusObserver    *status_observer,
+    GangScheduler     *scheduler = NULL);
 
   ~GangDecoder();
 
+  // Messages of the decoder, on its gang thread or strand.
+  virtual void OnMessage(rtc::Message *pmsg);
+
   bool Init();
 
   // only in worker thread
+  // A pooled decoder opens off the pool and returns true meanwhile, its
+  // status tells how the open went.
   bool Start();
   void Stop(bool force);
 
   bool IsVideoAvailable();
   bool IsAudioAvailable();
 
+  // Any number of observers share one decode, each added or removed
+  // without restarting the input. The decoder stops with the last one.
+  // rendition picks a scaled output added by AddRendition, 0 the main one.
+  // buff holds buff_size bytes, see GetVideoInfo and GetRenditionInfo.
   void StartVideoCapture(GangFrameObserver *observer,
-                         uint8_t           *buff);
+                         uint8_t           *buff,
+                         int                buff_size,
+                         int                rendition = 0);
   void StopVideoCapture(GangFrameObserver *observer);
+
+  // Deliver at most max_fps frames a second to observer, 0 for all.
+  void SetVideoFrameRate(GangFrameObserver *observer,
+                         int                max_fps);
+
+  // Scale and rate limit the decoded video to what is actually sent.
+  // Applied when the input is opened, so a decoder already running for
+  // other observers keeps its format. Call before StartVideoCapture.
+  void SetVideoFormat(int width,
+                      int height,
+                      int fps);
+
+  // observer->OnGangFrame is called on the gang thread after each 10ms of
+  // audio is written to buff, it must not block.
   void SetAudioFrameObserver(GangFrameObserver *observer,
                              uint8_t           *buff);
 
@@ -89,9 +166,93 @@ public:
   void GetAudioInfo(uint32_t *sample_rate,
                     uint8_t  *channels);
 
+  // Video as decoded, before SetVideoFormat. Valid after Init.
+  void GetSourceVideoInfo(int *width,
+                          int *height,
+                          int *fps);
+
+  // Scale a width x height copy of the video off the same decode.
+  // Call before Init. return: the rendition index from 1, <=0 on error
+  int  AddRendition(int width,
+                    int height);
+
+  // return: false for an unknown rendition
+  bool GetRenditionInfo(int     rendition,
+                        int    *width,
+                        int    *height,
+                        uint32 *buf_size);
+
   void SetRecordEnabled(bool enabled);
+
+  // Record camera packets as they are instead of transcoding them.
+  // Call before Start.
+  void SetRecordCopy(bool copy);
+
+  // Leave silent stretches of a transcoded recording out, or write them as
+  // empty Opus frames, instead of encoding them. Silence is an RMS under
+  // dbfs for a while. Call before recording starts.
+  void SetRecordSilence(GangSilenceMode mode,
+                        int             dbfs = -60);
+
+  // Opus settings of recorded audio, see GangAudioProfile. Takes effect
+  // at the next recording start.
+  void SetAudioProfile(const GangAudioProfile& profile);
+
+  // Get the audio level every 100ms. Call before Start.
+  void SetLevelObserver(LevelObserver *observer);
+
+  // Replace the status observer given at construction, NULL for none.
+  // Call before Start.
+  void SetStatusObserver(StatusObserver *observer);
+
+  // Decode and deliver only keyframes, for cheap low rate previews.
+  // Recording keeps the full rate. Can be called from any thread.
+  void SetKeyFrameOnly(bool key_only);
+  bool IsKeyFrameOnly();
+
+  // Stretch delivered audio by ppm parts per million to follow the clock
+  // of the audio consumer. Can be called from any thread.
+  void    SetAudioCompensation(int ppm);
+
+  // Source time in us of the first sample of the 10ms block in the audio
+  // buffer, INT64_MIN when not known. From OnGangFrame of the audio
+  // observer, before the next block overwrites it.
+  int64_t GetAudioTime();
+
+  // Cache up to max_pkts packets of the current GOP. Call before Start.
+  void SetGopCache(int max_pkts);
+
+  // Bound opening+probing and each packet read of the input, 0 waits
+  // forever. A read timeout reports the decoder Dead. Call before Init.
+  void SetIoTimeout(int open_ms,
+                    int read_ms);
+
+  // Slice threads of the video decoder, 0 for one per core. Pooled
+  // decoders default to 1 as the pool has the cores busy already.
+  // frame_threads adds frame threading, more throughput for threads-1
+  // frames of latency. Call before Init.
+  void SetDecoderThreads(int  threads,
+                         bool frame_threads = false);
+
+  // Keep the input probed by Init connected for ms so Start reuses it.
+  // Call before Init.
+  void SetKeepWarm(int ms);
+
+  // Keep the input connected for ms after the last observer leaves, its
+  // packets read but not decoded, so a returning one starts at once.
+  // Turns on the GOP cache if it is not set. Call before Start.
+  void SetLinger(int ms);
   void SendStatus(GangStatus status);
 
+  // Read input on a dedicated thread through a queue of size packets.
+  // policy is a PacketQueuePolicy. Call before Start.
+  void SetPacketQueue(int size,
+                      int policy);
+
+  // Can be called from any thread.
+  void GetPacketQueueStats(int     *occupancy,
+                           int64_t *dropped);
+
   // these can be called outside gang thread.
   // but only at beginning or end.
   void StartRec();
@@ -104,8 +265,16 @@ protected:
 
   // only in worker thread
   void StartVideoCapture_g(GangFrameObserver *observer,
-                           uint8_t           *buff);
+                           uint8_t           *buff,
+                           int                buff_size,
+                           int                rendition);
   void StopVideoCapture_g(GangFrameObserver *observer);
+  void SetVideoFrameRate_g(GangFrameObserver *observer,
+                           int                max_fps);
+  void SetVideoFormat_g(const GangVideoFormat& format);
+  void Linger();
+  void UpdateVideoDemand();
+  void DeliverVideoFrame();
   void SetAudioObserver_g(GangFrameObserver *observer,
                           uint8_t           *buff);
 
@@ -114,13 +283,35 @@ protected:
 private:
   class GangThread; // Forward declaration, defined in .cc.
 
-  const std::string  id_;
-  gang_decoder      *decoder_;
-  GangThread        *gang_thread_;
-  Thread            *worker_thread_;
-  GangFrameObserver *video_frame_observer_;
-  GangFrameObserver *audio_frame_observer_;
-  StatusObserver    *status_observer_;
+  // The decoder runs either on its own gang_thread_ or, given a scheduler,
+  // on a strand_ of the shared pool. Either way it sees one thread.
+  void PostGang(uint32            id,
+                rtc::MessageData *data = NULL);
+  void PostGangDelayed(int    cms,
+                       uint32 id);
+  void ClearGang(uint32 id);
+  bool IsGangCurrent() const;
+  bool GangFinished() const;
+
+  // The open of Start is done, on the gang thread.
+  void Opened(int err);
+
+  // Called by the reader of a pooled decoder once input is queued.
+  static void OnInput(void *opaque);
+
+  const std::string                id_;
+  gang_decoder                    *decoder_;
+  GangThread                      *gang_thread_;
+  std::shared_ptr<GangStrand>      strand_;
+  Thread                          *worker_thread_;
+  std::vector<VideoSink>           video_sinks_;
+  std::vector<GangFrameObserver *> started_observers_; // waiting for OPENED
+  bool                             opening_;
+  int                              open_err_; // set off the strand, read at OPENED
+  GangFrameObserver               *audio_frame_observer_;
+  StatusObserver                  *status_observer_;
+  LevelObserver                   *level_observer_;
+  int                              linger_ms_;
 
   mutable rtc::CriticalSection crit_;
 
@@ -4,10 +4,12 @@
 #include <libavfilter/buffersink.h>
 #include <libavfilter/buffersrc.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/time.h>
 #include "macrologger.h"
 
 #include "ffmpeg_transcoding.h"
 #include "ffmpeg_format.h"
+#include "ffmpeg_info_cache.h"
 #include "ffmpeg_log.h"
 
 void initialize_gang_decoder_globel() {
@@ -19,9 +21,58 @@ void initialize_gang_decoder_globel() {
 }
 
 void cleanup_gang_decoder_globel() {
+  set_stream_info_cache_dir(NULL);
   avformat_network_deinit();
 }
 
+void set_gang_stream_info_cache_dir(const char *dir) {
+  set_stream_info_cache_dir(dir);
+}
+
+// Make blocking input calls return on abort, once the reader is asked to
+// quit, or when the current operation runs past its deadline.
+static int io_interrupt_cb(void *opaque) {
+  gang_decoder *dec = (gang_decoder *)opaque;
+
+  if (__atomic_load_n(&dec->abort_request, __ATOMIC_SEQ_CST)) return 1;
+
+  if (dec->reading && __atomic_load_n(&dec->pkt_queue.abort, __ATOMIC_SEQ_CST)) return 1;
+
+  return dec->io_deadline && (av_gettime_relative() > dec->io_deadline);
+}
+
+// Only the thread doing input I/O arms it, the gang thread while opening
+// and the reader, if any, while reading.
+static void arm_io_deadline(gang_decoder *dec, int ms) {
+  dec->io_deadline = ms ? av_gettime_relative() + (int64_t)ms * 1000 : 0;
+}
+
+// open_input_streams bounded by open_timeout_ms.
+static int open_input(gang_decoder *dec) {
+  int err;
+
+  arm_io_deadline(dec, dec->open_timeout_ms);
+  err = open_input_streams(dec);
+  arm_io_deadline(dec, 0);
+
+  if (err == AVERROR_EXIT) LOG_INFO("Opening '%s' interrupted", dec->url);
+  return err;
+}
+
+// av_read_frame bounded by read_timeout_ms.
+static int read_input(gang_decoder *dec, AVPacket *pkt) {
+  int ret;
+
+  arm_io_deadline(dec, dec->read_timeout_ms);
+  ret = av_read_frame(dec->ifmt_ctx, pkt);
+
+  if ((ret == AVERROR_EXIT) && dec->io_deadline && (av_gettime_relative() > dec->io_deadline)) {
+    LOG_INFO("No input for %d ms, '%s' stalled", dec->read_timeout_ms, dec->url);
+  }
+  arm_io_deadline(dec, 0);
+  return ret;
+}
+
 // create gang_decode with given url
 gang_decoder* new_gang_decoder(const char *url, const char *rec_name, int rec_on, int audio_off) {
   gang_decoder *dec = (gang_decoder *)malloc(sizeof(gang_decoder));
@@ -30,6 +81,7 @@ gang_decoder* new_gang_decoder(const char *url, const char *rec_name, int rec_on
     dec->url              = av_strdup(url);
     dec->rec_name         = av_strdup(rec_name);
     dec->rec_enabled      = rec_on;
+    dec->rec_copy         = 0;
     dec->audio_off        = audio_off;
     dec->no_video         = 1;
     dec->no_audio         = 1;
@@ -39,10 +91,48 @@ gang_decoder* new_gang_decoder(const char *url, const char *rec_name, int rec_on
     dec->height           = 0;
     dec->fps              = 0;
     dec->pix_fmt          = AV_PIX_FMT_NONE;
+    dec->src_width        = 0;
+    dec->src_height       = 0;
+    dec->src_fps          = 0;
+    dec->out_width        = 0;
+    dec->out_height       = 0;
+    dec->out_fps          = 0;
+    dec->filter_fps       = 0;
+    dec->filter_key_only  = 0;
+    dec->video_demand     = GANG_DEMAND_ALL;
+    dec->video_skip       = 0;
+    dec->video_discard    = AVDISCARD_DEFAULT;
+    dec->key_only         = 0;
+    dec->key_wait         = 0;
+    dec->video_idle       = 0;
+    dec->resume_pos       = 0;
+    dec->resume_index     = -1;
+    dec->drain_index      = -1;
+    dec->flush_index      = -1;
+    dec->video_threads    = GANG_VIDEO_THREADS;
+    dec->video_frame_threads = 0;
+    dec->audio_block      = 0;
+    dec->audio_comp_ppm   = 0;
+    dec->audio_time       = AV_NOPTS_VALUE;
+    dec->level_wanted     = 0;
+    dec->level_window     = 0;
+    dec->level_rms        = AUDIO_LEVEL_FLOOR_DBFS;
+    dec->level_peak       = AUDIO_LEVEL_FLOOR_DBFS;
+    dec->level_ready      = 0;
+    dec->rec_silence      = GANG_SILENCE_ENCODE;
+    dec->silence_dbfs     = GANG_SILENCE_DBFS;
+    dec->silent_ms        = 0;
+    dec->audio_profile.bit_rate       = 0;
+    dec->audio_profile.complexity     = -1;
+    dec->audio_profile.application    = GANG_OPUS_DEFAULT;
+    dec->audio_profile.dtx            = 0;
+    dec->audio_profile.frame_duration = 0;
+    memset(&dec->audio_chunker, 0, sizeof(dec->audio_chunker));
     dec->channels         = 0;
     dec->sample_rate      = 0;
     dec->bytes_per_sample = 2; // always output s16
-    dec->video_buff       = NULL;
+    dec->video_by_ref     = 0;
+    dec->video_frame      = NULL;
     dec->audio_buff       = NULL;
     dec->video_buff_size  = 0;
     dec->audio_buff_size  = 0;
@@ -52,12 +142,147 @@ gang_decoder* new_gang_decoder(const char *url, const char *rec_name, int rec_on
     dec->fsc_size         = 0;
     dec->i_frame          = NULL;
     dec->o_frame          = NULL;
+    dec->pkt_queue_size   = 0;
+    dec->io_cb.callback   = io_interrupt_cb;
+    dec->io_cb.opaque     = dec;
+    dec->open_timeout_ms  = GANG_IO_OPEN_TIMEOUT_MS;
+    dec->read_timeout_ms  = GANG_IO_READ_TIMEOUT_MS;
+    dec->io_deadline      = 0;
+    dec->abort_request    = 0;
+    dec->pkt_queue_policy = PKT_QUEUE_BLOCK;
+    dec->read_wait_ms     = GANG_PKT_QUEUE_WAIT_MS;
+    dec->reading          = 0;
+    dec->pkt_queue.pkts   = NULL;
+    dec->gop_cache_size   = 0;
+    dec->nb_renditions    = 0;
+    dec->keep_warm_ms     = 0;
+    dec->warm_deadline    = 0;
+    gop_cache_init(&dec->gop_cache, 0, -1);
     av_init_packet(&dec->i_pkt);
     av_init_packet(&dec->o_pkt);
   }
   return dec;
 }
 
+void set_gang_decoder_pkt_queue(gang_decoder *dec, int size, int policy) {
+  dec->pkt_queue_size   = size > 0 ? size : 0;
+  dec->pkt_queue_policy = policy;
+}
+
+void set_gang_decoder_io_timeout(gang_decoder *dec, int open_ms, int read_ms) {
+  dec->open_timeout_ms = open_ms > 0 ? open_ms : 0;
+  dec->read_timeout_ms = read_ms > 0 ? read_ms : 0;
+}
+
+void abort_gang_decoder(gang_decoder *dec) {
+  __atomic_store_n(&dec->abort_request, 1, __ATOMIC_SEQ_CST);
+}
+
+void set_gang_decoder_read_wait(gang_decoder *dec, int ms) {
+  dec->read_wait_ms = ms > 0 ? ms : 0;
+}
+
+void set_gang_decoder_rec_copy(gang_decoder *dec, int rec_copy) {
+  dec->rec_copy = rec_copy;
+}
+
+void set_gang_decoder_keep_warm(gang_decoder *dec, int ms) {
+  dec->keep_warm_ms = ms > 0 ? ms : 0;
+}
+
+int add_gang_decoder_rendition(gang_decoder *dec, int width, int height) {
+  GangRendition *r;
+
+  if ((dec->nb_renditions >= GANG_MAX_RENDITIONS) || (width <= 0) || (height <= 0)) {
+    return AVERROR(EINVAL);
+  }
+  r                 = &dec->renditions[dec->nb_renditions];
+  r->width          = width & ~1;
+  r->height         = height & ~1;
+  r->buff_size      = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, r->width, r->height, 1);
+  r->buffersink_ctx = NULL;
+  r->frame          = NULL;
+  r->ready          = 0;
+  return ++dec->nb_renditions;
+}
+
+void set_gang_decoder_video_format(gang_decoder *dec, int width, int height, int fps) {
+  dec->out_width  = width > 0 ? width & ~1 : 0;
+  dec->out_height = height > 0 ? height & ~1 : 0;
+  dec->out_fps    = fps > 0 ? fps : 0;
+}
+
+void set_gang_decoder_video_demand(gang_decoder *dec, int demand, int skip) {
+  dec->video_demand = demand;
+  dec->video_skip   = skip;
+}
+
+void set_gang_decoder_key_only(gang_decoder *dec, int key_only) {
+  __atomic_store_n(&dec->key_only, key_only, __ATOMIC_SEQ_CST);
+}
+
+int gang_decoder_key_only(gang_decoder *dec) {
+  return __atomic_load_n(&dec->key_only, __ATOMIC_SEQ_CST);
+}
+
+void set_gang_decoder_audio_compensation(gang_decoder *dec, int ppm) {
+  __atomic_store_n(&dec->audio_comp_ppm, ppm, __ATOMIC_SEQ_CST);
+}
+
+int64_t gang_decoder_audio_time(gang_decoder *dec) {
+  return dec->audio_time;
+}
+
+void set_gang_decoder_level_wanted(gang_decoder *dec, int wanted) {
+  dec->level_wanted = wanted ? 1 : 0;
+}
+
+int gang_decoder_audio_level(gang_decoder *dec, int *rms_dbfs, int *peak_dbfs) {
+  if (!dec->level_ready) {
+    return 0;
+  }
+  *rms_dbfs        = dec->level_rms;
+  *peak_dbfs       = dec->level_peak;
+  dec->level_ready = 0;
+  return 1;
+}
+
+void set_gang_decoder_rec_silence(gang_decoder *dec, int mode, int dbfs) {
+  dec->rec_silence  = mode;
+  dec->silence_dbfs = dbfs;
+}
+
+void set_gang_decoder_audio_profile(gang_decoder *dec, const GangAudioProfile *profile) {
+  dec->audio_profile = *profile;
+
+  if (profile->dtx) dec->rec_silence = GANG_SILENCE_DTX;
+  else if (dec->rec_silence == GANG_SILENCE_DTX) dec->rec_silence = GANG_SILENCE_ENCODE;
+}
+
+void set_gang_decoder_threads(gang_decoder *dec, int threads, int frame_threads) {
+  dec->video_threads       = threads > 0 ? threads : 0;
+  dec->video_frame_threads = frame_threads ? 1 : 0;
+}
+
+void set_gang_decoder_gop_cache(gang_decoder *dec, int max_pkts) {
+  dec->gop_cache_size = max_pkts > 0 ? max_pkts : 0;
+}
+
+int gang_pkt_queue_occupancy(gang_decoder *dec) {
+  return (int)packet_queue_occupancy(&dec->pkt_queue);
+}
+
+int64_t gang_pkt_queue_dropped(gang_decoder *dec) {
+  return dec->pkt_queue.pkts ? packet_queue_dropped(&dec->pkt_queue) : 0;
+}
+
+int gang_decoder_arm_input(gang_decoder *dec, PacketQueueNotify notify, void *opaque) {
+  if (!dec->reading || gang_decoder_draining(dec) || gang_decoder_resuming(dec)) {
+    return 0;
+  }
+  return packet_queue_arm(&dec->pkt_queue, notify, opaque);
+}
+
 void free_gang_decoder(gang_decoder *dec) {
   if (dec) {
     if (dec->url) {
@@ -80,9 +305,9 @@ static void init_av_info(gang_decoder *dec) {
 
     if (fsc.is_video) {
       dec->no_video        = 0;
-      dec->pix_fmt         = fsc.os->codec->pix_fmt;
-      dec->width           = fsc.os->codec->width;
-      dec->height          = fsc.os->codec->height;
+      dec->pix_fmt         = fsc.pix_fmt;
+      dec->width           = fsc.width;
+      dec->height          = fsc.height;
       dec->video_buff_size = av_image_get_buffer_size(
         dec->pix_fmt,
         dec->width,
@@ -96,6 +321,11 @@ static void init_av_info(gang_decoder *dec) {
         // TODO maybe need calculate it.
         dec->fps = 25;
       }
+      dec->src_width  = fsc.is->codec->width;
+      dec->src_height = fsc.is->codec->height;
+      dec->src_fps    = dec->fps;
+
+      if (dec->out_fps && (dec->out_fps < dec->fps)) dec->fps = dec->out_fps;
       LOG_DEBUG(
         "pix_fmt:%s, width:%d, height:%d, fps:%d, buff_size:%d",
         av_get_pix_fmt_name(dec->pix_fmt),
@@ -105,8 +335,8 @@ static void init_av_info(gang_decoder *dec) {
         dec->video_buff_size);
     } else {
       dec->no_audio        = 0;
-      dec->channels        = fsc.os->codec->channels;
-      dec->sample_rate     = fsc.os->codec->sample_rate;
+      dec->channels        = fsc.channels;
+      dec->sample_rate     = fsc.sample_rate;
       dec->audio_buff_size = dec->bytes_per_sample * dec->channels * dec->sample_rate / 100;
       LOG_DEBUG(
         "channels:%d, sample_rate:%d, buff_size:%d",
@@ -120,23 +350,222 @@ static void init_av_info(gang_decoder *dec) {
 int init_gang_av_info(gang_decoder *dec) {
   int err;
 
-  err = open_input_streams(dec);
-  if (!err) err = open_output_streams(dec, 0);
+  err = open_input(dec);
   if (!err) init_av_info(dec);
 
+  if (!err && dec->keep_warm_ms) {
+    dec->warm_deadline = av_gettime_relative() + (int64_t)dec->keep_warm_ms * 1000;
+    LOG_DEBUG("Keep probed input for %d ms", dec->keep_warm_ms);
+    return 0;
+  }
+
   close_gang_decoder(dec);
   return err;
 }
 
+void release_gang_warm_input(gang_decoder *dec, int force) {
+  if (!dec->warm_deadline) {
+    return;
+  }
+
+  if (force || (av_gettime_relative() >= dec->warm_deadline)) {
+    LOG_DEBUG("Release probed input");
+    close_gang_decoder(dec);
+  }
+}
+
+
+static void* read_thread_run(void *opaque) {
+  gang_decoder *dec = (gang_decoder *)opaque;
+  AVPacket      pkt;
+  int           ret;
+
+  av_init_packet(&pkt);
+  pkt.data = NULL;
+  pkt.size = 0;
+
+  while (1) {
+    ret = read_input(dec, &pkt);
+    if (ret < 0) {
+      LOG_DEBUG("reader stopped with %d", ret);
+      packet_queue_set_eof(&dec->pkt_queue, ret);
+      break;
+    }
+
+    if (packet_queue_put(&dec->pkt_queue, &pkt) < 0) break;
+  }
+  return NULL;
+}
+
+// return: input index of the video stream, -1 for none
+static int video_stream_index(gang_decoder *dec) {
+  int i;
+
+  for (i = 0; i < dec->fsc_size; i++) {
+    if (dec->fscs[i].is_video) return dec->fscs[i].is->index;
+  }
+  return -1;
+}
+
+static int start_reader(gang_decoder *dec) {
+  int err;
+
+  err = packet_queue_init(&dec->pkt_queue, dec->pkt_queue_size, dec->pkt_queue_policy, video_stream_index(dec));
+  if (err) return err;
+
+  dec->reading = 1;
+
+  if (pthread_create(&dec->read_thread, NULL, read_thread_run, dec)) {
+    LOG_ERROR("Could not create read thread");
+    dec->reading = 0;
+    packet_queue_destroy(&dec->pkt_queue);
+    return AVERROR(EAGAIN);
+  }
+  return 0;
+}
+
+static void stop_reader(gang_decoder *dec) {
+  if (!dec->reading) {
+    return;
+  }
+  packet_queue_abort(&dec->pkt_queue);
+  pthread_join(dec->read_thread, NULL);
+  dec->reading = 0;
+  packet_queue_destroy(&dec->pkt_queue);
+}
+
+// Pipelined mode takes packets from the reader, otherwise read inline.
+// return: 0->got, AVERROR(EAGAIN)->nothing queued yet, <0->error
+static int read_packet(gang_decoder *dec) {
+  if (dec->reading) return packet_queue_get(&dec->pkt_queue, &dec->i_pkt, dec->read_wait_ms);
+
+  return read_input(dec, &dec->i_pkt);
+}
+
+// Key only output and the wait for a keyframe leave gaps that a rate
+// limiting filter would fill with repeats of the last frame.
+static int video_key_only(gang_decoder *dec) {
+  return gang_decoder_key_only(dec) || dec->key_wait;
+}
+
+// Scale and rate limit the video in its filter graph, so delivery and
+// everything after it only handle the size and rate that is sent.
+// A transcoded recording keeps the source format, key only output is not
+// rate limited.
+static int apply_video_format(gang_decoder *dec) {
+  FilterStreamContext *fsc = NULL;
+  AVCodecContext      *ctx;
+  AVRational           rate;
+  char                 spec[128];
+  int                  len = 0;
+  int                  i;
+
+  dec->filter_key_only = video_key_only(dec);
+
+  for (i = 0; i < dec->fsc_size; i++) {
+    if (dec->fscs[i].is_video) fsc = &dec->fscs[i];
+  }
+
+  if (!fsc || (!dec->out_width && !dec->out_fps)) {
+    dec->filter_fps = 0;
+    return 0;
+  }
+
+  // A rebuilt graph keeps what the recording encoder was opened with.
+  if (dec->rec_enabled && !dec->rec_copy) {
+    if (fsc->filter_graph) return 0;
+
+    LOG_INFO("Keep the source video format for recording");
+    dec->filter_fps = 0;
+    return 0;
+  }
+  ctx             = fsc->is->codec;
+  rate            = fsc->is->r_frame_rate;
+  dec->filter_fps = 0;
+
+  // Never scale up, nor raise the rate.
+  if (dec->out_width && dec->out_height &&
+      (dec->out_width < ctx->width) && (dec->out_height < ctx->height)) {
+    len         += snprintf(spec + len, sizeof(spec) - len, "scale=%d:%d,", dec->out_width, dec->out_height);
+    fsc->width  = dec->out_width;
+    fsc->height = dec->out_height;
+  }
+
+  if (dec->out_fps && !dec->filter_key_only && (!rate.den || (dec->out_fps < rate.num / rate.den))) {
+    len            += snprintf(spec + len, sizeof(spec) - len, "fps=fps=%d,", dec->out_fps);
+    dec->filter_fps = 1;
+  }
+
+  // A rebuilt graph may have nothing left to do.
+  if (len) spec[len - 1] = '\0';
+  else snprintf(spec, sizeof(spec), "null");
+  LOG_DEBUG("Video filter: %s", spec);
+
+  av_freep(&fsc->filter_spec);
+  fsc->filter_spec = av_strdup(spec);
+  return fsc->filter_spec ? 0 : AVERROR(ENOMEM);
+}
+
+// Build the video graph again from the current format and key only mode.
+// return error
+static int reset_video_filter(gang_decoder *dec, FilterStreamContext *fsc) {
+  int err = apply_video_format(dec);
+
+  if (!err) err = reset_filter(fsc);
+  if (err) LOG_ERROR("Could not rebuild the video filter");
+  return err;
+}
+
+// Audio goes from the decoder straight to the delivery format.
+static int open_audio_chunker(gang_decoder *dec) {
+  FilterStreamContext *fsc;
+  int                  i;
+
+  for (i = 0; i < dec->fsc_size; i++) {
+    fsc = &dec->fscs[i];
+
+    if (fsc->is_video) continue;
+
+    dec->audio_block  = fsc->sample_rate / 100;
+    dec->level_window = fsc->sample_rate * fsc->channels * GANG_LEVEL_WINDOW_MS / 1000;
+    return audio_chunker_init(&dec->audio_chunker, fsc->is->codec, fsc->channel_layout, fsc->sample_rate, fsc->sample_fmt);
+  }
+  return 0;
+}
+
 // return error
 int open_gang_decoder(gang_decoder *dec) {
-  int err;
+  int err, i;
 
-  err = open_input_streams(dec);
-  if (!err) err = open_output_streams(dec, dec->rec_enabled);
+  if (dec->warm_deadline && (av_gettime_relative() < dec->warm_deadline)) {
+    // Reuse the connection and codecs probed by init_gang_av_info.
+    dec->warm_deadline = 0;
+    err                = 0;
+  } else {
+    release_gang_warm_input(dec, 1);
+    err = open_input(dec);
+  }
+  if (!err) err = gop_cache_init(&dec->gop_cache, dec->gop_cache_size, video_stream_index(dec));
+  dec->video_skip    = 0;
+  dec->video_discard = AVDISCARD_DEFAULT;
+  dec->key_wait      = 0;
+  dec->video_idle    = 0;
+  dec->resume_index  = -1;
+  dec->drain_index   = -1;
+  dec->flush_index   = -1;
+
+  if (!err) err = apply_video_format(dec);
   if (!err) err = init_filters(dec->fscs, dec->fsc_size);
+  if (!err) err = open_audio_chunker(dec);
+  if (!err && dec->rec_enabled) err = start_gang_rec(dec);
   if (!err) err = init_frame(&dec->i_frame);
   if (!err) err = init_frame(&dec->o_frame);
+  if (!err) err = init_frame(&dec->video_frame);
+
+  for (i = 0; !err && i < dec->nb_renditions; i++) {
+    err = init_frame(&dec->renditions[i].frame);
+  }
+  if (!err && dec->pkt_queue_size) err = start_reader(dec);
 
   if (err) {
     close_gang_decoder(dec);
@@ -150,6 +579,10 @@ int open_gang_decoder(gang_decoder *dec) {
 void close_gang_decoder(gang_decoder *dec) {
   int i;
 
+  stop_reader(dec);
+  audio_chunker_free(&dec->audio_chunker);
+  dec->warm_deadline = 0;
+  gop_cache_free(&dec->gop_cache);
   av_packet_unref(&dec->i_pkt);
   av_packet_unref(&dec->o_pkt);
   av_init_packet(&dec->i_pkt);
@@ -160,6 +593,17 @@ void close_gang_decoder(gang_decoder *dec) {
     av_frame_free(&dec->o_frame);
   }
 
+  if (dec->video_frame) {
+    av_frame_unref(dec->video_frame);
+    av_frame_free(&dec->video_frame);
+  }
+
+  for (i = 0; i < dec->nb_renditions; i++) {
+    av_frame_free(&dec->renditions[i].frame);
+    dec->renditions[i].buffersink_ctx = NULL;
+    dec->renditions[i].ready          = 0;
+  }
+
   if (dec->i_frame) {
     av_frame_unref(dec->i_frame);
     av_frame_free(&dec->i_frame);
@@ -172,22 +616,15 @@ void close_gang_decoder(gang_decoder *dec) {
     avformat_close_input(&dec->ifmt_ctx);
   }
 
-  if (dec->ofmt_ctx) {
-    for (i = 0; i < dec->ofmt_ctx->nb_streams; i++) {
-      avcodec_close(dec->ofmt_ctx->streams[i]->codec);
-    }
-
-    if (dec->rec_enabled && !(dec->ofmt_ctx->oformat->flags & AVFMT_NOFILE)) avio_closep(&dec->ofmt_ctx->pb);
-    avformat_free_context(dec->ofmt_ctx);
-    dec->ofmt_ctx = NULL;
-  }
+  close_output_streams(dec);
 
   if (dec->fscs) {
     for (i = 0; i < dec->fsc_size; i++) {
+      if (dec->fscs[i].filter_spec) {
+        av_freep(&dec->fscs[i].filter_spec);
+      }
+
       if (dec->fscs[i].filter_graph) {
-        if (dec->fscs[i].filter_spec) {
-          av_freep(&dec->fscs[i].filter_spec);
-        }
         avfilter_graph_free(&dec->fscs[i].filter_graph);
       }
     }
@@ -198,29 +635,52 @@ void close_gang_decoder(gang_decoder *dec) {
 }
 
 static int copy_send_frame(gang_decoder *dec, FilterStreamContext *fsc) {
-  int ret = 0;
+  if (!fsc->is_video || !dec->video_by_ref) {
+    LOG_INFO("no video consumer");
+    return 0;
+  }
+  av_frame_unref(dec->video_frame);
+  return av_frame_ref(dec->video_frame, dec->o_frame);
+}
 
-  if (fsc->is_video && dec->video_buff)
-    ret = av_image_copy_to_buffer(
-      dec->video_buff,
-      dec->video_buff_size,
-      (const uint8_t **)(dec->o_frame->data),
-      dec->o_frame->linesize,
-      dec->pix_fmt,
-      dec->width,
-      dec->height,
-      1);
-  else if (!fsc->is_video && dec->audio_buff) memcpy(dec->audio_buff,
-                                                     dec->o_frame->extended_data[0],
-                                                     dec->audio_buff_size);
-  else {
-    LOG_INFO(
-      "is_video:%d, no video_buff:%d, no audio_buff:%d",
-      fsc->is_video,
-      !dec->video_buff,
-      !dec->audio_buff);
+int gang_copy_video_frame(const AVFrame *frame, uint8_t *buff, int buff_size) {
+  // A reopen may have grown the format past what the sink was sized for.
+  if (av_image_get_buffer_size(frame->format, frame->width, frame->height, 1) > buff_size) {
+    return AVERROR(ENOSPC);
+  }
+  return av_image_copy_to_buffer(
+    buff,
+    buff_size,
+    (const uint8_t **)(frame->data),
+    frame->linesize,
+    frame->format,
+    frame->width,
+    frame->height,
+    1);
+}
+
+// Keep the latest frame of every rendition, their sinks must be drained
+// even when nobody takes them. A rate limiting filter may have put several
+// frames in each, the older ones are dropped. Called once the main sink is
+// drained, o_frame is free by then.
+static void pull_renditions(gang_decoder *dec, FilterStreamContext *fsc) {
+  GangRendition *r;
+  int            i;
+
+  av_frame_unref(dec->o_frame);
+
+  for (i = 0; i < fsc->nb_renditions; i++) {
+    r = &fsc->renditions[i];
+
+    av_frame_unref(r->frame);
+    r->ready = 0;
+
+    while (av_buffersink_get_frame(r->buffersink_ctx, dec->o_frame) >= 0) {
+      av_frame_unref(r->frame);
+      av_frame_move_ref(r->frame, dec->o_frame);
+      r->ready = 1;
+    }
   }
-  return ret;
 }
 
 // From transcoding.c
@@ -265,7 +725,7 @@ static int filter_encode_write_frame(gang_decoder *dec, FilterStreamContext *fsc
     }
 
     // write to record file
-    if (dec->recording) {
+    if (dec->recording && !fsc->copy) {
       ret = encode_write_frame(dec, fsc, NULL);
 
       if (ret < 0) {
@@ -275,32 +735,397 @@ static int filter_encode_write_frame(gang_decoder *dec, FilterStreamContext *fsc
     }
   }
 
+  if (fsc->is_video) pull_renditions(dec, fsc);
+
   if (ret > 0) ret = 0;
   return ret;
 }
 
+// A transcoded recording takes every frame whatever live consumers want.
+static int rec_transcodes(gang_decoder *dec, FilterStreamContext *fsc) {
+  return dec->recording && !fsc->copy;
+}
+
+// Whether anything takes the decoded frames of fsc.
+static int stream_consumed(gang_decoder *dec, FilterStreamContext *fsc) {
+  if (rec_transcodes(dec, fsc)) return 1;
+
+  return fsc->is_video ? dec->video_by_ref : (dec->audio_buff != NULL) || dec->level_wanted;
+}
+
+// Video comes back after packets were left undecoded. Decode the cached
+// GOP up to the current packet without output, so it decodes at once, or
+// wait for the next keyframe without a cache. Feeds GANG_RESUME_STEP_PKTS
+// packets a call.
+// return: 1 while cached packets are left, <0->error
+static int resume_video_decoder(gang_decoder *dec, FilterStreamContext *fsc) {
+  GopCache *c = &dec->gop_cache;
+  AVPacket  pkt;
+  int       wait;
+  int       end;
+  int       err;
+
+  if (dec->video_idle) {
+    dec->video_idle = 0;
+    dec->resume_pos = 0;
+    avcodec_flush_buffers(fsc->is->codec);
+
+    // Key only mode waits for a keyframe anyway.
+    wait = !c->valid || gang_decoder_key_only(dec);
+    if (wait) dec->key_wait = 1;
+
+    // The pts jumps over the idle time, the old graph would fill the jump
+    // with repeats.
+    if ((err = reset_video_filter(dec, fsc)) < 0) return err;
+
+    if (wait) return 0;
+  }
+
+  // The last cached packet is the current one, nothing is read meanwhile.
+  end = FFMIN(dec->resume_pos + GANG_RESUME_STEP_PKTS, c->size - 1);
+
+  for (; dec->resume_pos < end; dec->resume_pos++) {
+    if (c->pkts[dec->resume_pos].stream_index != fsc->is->index) continue;
+
+    if (av_packet_ref(&pkt, &c->pkts[dec->resume_pos]) < 0) {
+      dec->resume_pos = c->size - 1;
+      break;
+    }
+    av_packet_rescale_ts(&pkt, fsc->is->time_base, fsc->is->codec->time_base);
+
+    if (avcodec_send_packet(fsc->is->codec, &pkt) < 0) {
+      LOG_INFO("Decode of cached GOP failed");
+    }
+    av_packet_unref(&pkt);
+
+    while (avcodec_receive_frame(fsc->is->codec, dec->i_frame) >= 0) av_frame_unref(dec->i_frame);
+  }
+
+  if (dec->resume_pos < c->size - 1) {
+    return 1;
+  }
+  LOG_DEBUG("Resumed video with %d cached packets", c->size - 1);
+  return 0;
+}
+
+// Have the video decoder skip what the demand does not need.
+static void update_video_discard(gang_decoder *dec, FilterStreamContext *fsc) {
+  enum AVDiscard discard = AVDISCARD_DEFAULT;
+
+  // Key only mode drops packets before the decoder, see skip_video_packet.
+  if (!rec_transcodes(dec, fsc) && (dec->video_demand == GANG_DEMAND_REF)) {
+    discard = AVDISCARD_NONREF;
+  }
+
+  if (discard == dec->video_discard) {
+    return;
+  }
+  LOG_DEBUG("Video skip_frame %d -> %d", dec->video_discard, discard);
+  dec->video_discard         = discard;
+  fsc->is->codec->skip_frame = discard;
+}
+
+// In key only mode, drop video packets before the decoder up to the next
+// keyframe. Nothing refers across a keyframe, so it decodes on its own.
+static int skip_video_packet(gang_decoder *dec) {
+  if (dec->i_pkt.flags & AV_PKT_FLAG_KEY) {
+    dec->key_wait = 0;
+    return 0;
+  }
+
+  if (gang_decoder_key_only(dec)) dec->key_wait = 1;
+  return dec->key_wait;
+}
+
+static int audio_block_ready(gang_decoder *dec) {
+  return dec->audio_buff && (audio_chunker_size(&dec->audio_chunker, AUDIO_CHUNK_LIVE) >= dec->audio_block);
+}
+
+// Hand out the next 10ms of audio.
+static int next_audio_block(gang_decoder *dec) {
+  int64_t pts;
+
+  if (!audio_block_ready(dec)) {
+    return GANG_ERROR_DATA;
+  }
+
+  if (audio_chunker_read(&dec->audio_chunker, AUDIO_CHUNK_LIVE, dec->audio_buff, dec->audio_block, &pts) < 0) {
+    return GANG_ERROR_DATA;
+  }
+  dec->audio_time = pts == AV_NOPTS_VALUE ? AV_NOPTS_VALUE :
+                    av_rescale_q(pts, av_make_q(1, dec->audio_chunker.sample_rate), AV_TIME_BASE_Q);
+  return GANG_AUDIO_DATA;
+}
+
+// Publish the level of each full window.
+static void update_audio_level(gang_decoder *dec) {
+  AudioLevel *level = &dec->audio_chunker.level;
+
+  if (!dec->level_window || (level->samples < dec->level_window)) {
+    return;
+  }
+  dec->level_rms   = audio_level_rms_dbfs(level);
+  dec->level_peak  = audio_level_peak_dbfs(level);
+  dec->level_ready = 1;
+  audio_level_reset(level);
+}
+
+// Follow silent stretches of the recording, logging where they start and
+// end. return: 1 for a frame past the hold of one
+static int rec_frame_silent(gang_decoder *dec, const AVFrame *frame, int channels) {
+  AudioLevel level;
+
+  if (dec->rec_silence == GANG_SILENCE_ENCODE) {
+    return 0;
+  }
+  audio_level_reset(&level);
+  audio_level_add(&level, (const int16_t *)frame->data[0], frame->nb_samples * channels);
+
+  if (!audio_level_below(&level, dec->silence_dbfs)) {
+    if (dec->silent_ms > GANG_SILENCE_HOLD_MS) {
+      LOG_DEBUG("rec silence ends at pts %" PRId64, frame->pts);
+    }
+    dec->silent_ms = 0;
+    return 0;
+  }
+
+  if (dec->silent_ms > GANG_SILENCE_HOLD_MS) {
+    return 1;
+  }
+  dec->silent_ms += frame->nb_samples * 1000 / frame->sample_rate;
+
+  if (dec->silent_ms > GANG_SILENCE_HOLD_MS) {
+    LOG_DEBUG("rec silence from pts %" PRId64, frame->pts);
+    return 1;
+  }
+  return 0;
+}
+
+// Encode every full frame of the recording output, silent ones as the
+// silence mode says.
+static int encode_audio_chunks(gang_decoder *dec, FilterStreamContext *fsc) {
+  AVCodecContext *enc = fsc->os->codec;
+  int             n   = enc->frame_size > 0 ? enc->frame_size : dec->audio_block;
+  int             ret;
+
+  while (audio_chunker_size(&dec->audio_chunker, AUDIO_CHUNK_REC) >= n) {
+    av_frame_unref(dec->o_frame);
+    dec->o_frame->nb_samples     = n;
+    dec->o_frame->format         = enc->sample_fmt;
+    dec->o_frame->channel_layout = enc->channel_layout;
+    dec->o_frame->sample_rate    = enc->sample_rate;
+
+    if ((ret = av_frame_get_buffer(dec->o_frame, 0)) < 0) return ret;
+
+    ret = audio_chunker_read(&dec->audio_chunker, AUDIO_CHUNK_REC, dec->o_frame->data[0], n, &dec->o_frame->pts);
+    if (ret < 0) return ret;
+
+    if (rec_frame_silent(dec, dec->o_frame, enc->channels)) {
+      if (dec->rec_silence == GANG_SILENCE_DROP) continue;
+
+      // Frame sizes Opus has no empty frame for are encoded after all.
+      ret = write_dtx_frame(dec, fsc);
+      if (ret != AVERROR(ENOSYS)) {
+        if (ret < 0) return ret;
+
+        continue;
+      }
+    }
+
+    ret = encode_write_frame(dec, fsc, NULL);
+    if (ret < 0) return ret;
+  }
+  return 0;
+}
+
+// Convert a decoded audio frame once for delivery and the recording.
+// Delivery takes it in exact 10ms blocks, the first one now and the rest
+// over the next steps.
+static int put_audio_frame(gang_decoder *dec, FilterStreamContext *fsc) {
+  int outputs = 0;
+
+  if (dec->audio_buff) outputs |= 1 << AUDIO_CHUNK_LIVE;
+  else audio_chunker_reset(&dec->audio_chunker, AUDIO_CHUNK_LIVE);
+
+  if ((outputs & (1 << AUDIO_CHUNK_LIVE)) &&
+      (audio_chunker_set_compensation(&dec->audio_chunker,
+                                      __atomic_load_n(&dec->audio_comp_ppm, __ATOMIC_SEQ_CST)) < 0)) {
+    LOG_DEBUG("audio compensation error");
+  }
+
+  if (rec_transcodes(dec, fsc)) outputs |= 1 << AUDIO_CHUNK_REC;
+
+  if (audio_chunker_put(&dec->audio_chunker, dec->i_frame, fsc->is->codec->time_base, outputs) < 0) {
+    return GANG_ERROR_DATA;
+  }
+  update_audio_level(dec);
+
+  if ((outputs & (1 << AUDIO_CHUNK_REC)) && (encode_audio_chunks(dec, fsc) < 0)) {
+    LOG_DEBUG("encode audio error");
+    return GANG_FITAL;
+  }
+  return next_audio_block(dec);
+}
+
+// Take the next frame the decoder of fsc has ready, then filter and hand
+// it out. Once it has none, the next step reads a packet again.
+// return: as gang_decode_next_frame
+static int receive_frame(gang_decoder *dec, FilterStreamContext *fsc) {
+  int key;
+  int err;
+
+  av_frame_unref(dec->i_frame);
+  err = avcodec_receive_frame(fsc->is->codec, dec->i_frame);
+
+  if (err < 0) {
+    if ((err != AVERROR(EAGAIN)) && (err != AVERROR_EOF)) LOG_INFO("Decode failed");
+    dec->drain_index = -1;
+    return GANG_ERROR_DATA;
+  }
+
+  dec->i_frame->pts = av_frame_get_best_effort_timestamp(dec->i_frame);
+
+  if (!fsc->is_video) return put_audio_frame(dec, fsc);
+
+  // Nobody takes it, skip filtering and copying. A rate limiting filter
+  // must see every frame or it duplicates the last one.
+  if (dec->video_skip && !dec->filter_fps && !rec_transcodes(dec, fsc)) {
+    return GANG_ERROR_DATA;
+  }
+  key = dec->i_frame->key_frame;
+  err = filter_encode_write_frame(dec, fsc, 1);
+
+  if (err < 0) return GANG_FITAL;
+
+  // Decoded in full for the recording, keyframes are still all delivered.
+  if (!key && gang_decoder_key_only(dec)) return GANG_ERROR_DATA;
+  if (dec->video_by_ref) return GANG_VIDEO_DATA;
+  LOG_DEBUG("Unexpected type");
+  return GANG_ERROR_DATA;
+}
+
+// Decode i_pkt of fscs[fs_index], demuxing, the GOP cache and copy
+// recording already saw it. Called again while the video resumes.
+static int decode_packet(gang_decoder *dec, int fs_index) {
+  FilterStreamContext *fsc = &dec->fscs[fs_index];
+  AVStream            *is  = fsc->is;
+  int                  err;
+
+  // Decoding and filtering wait for a consumer.
+  if (!stream_consumed(dec, fsc)) {
+    if (fsc->is_video) dec->video_idle = 1;
+    else audio_chunker_reset(&dec->audio_chunker, AUDIO_CHUNK_LIVE);
+    dec->resume_index = -1;
+    return GANG_ERROR_DATA;
+  }
+
+  if (fsc->is_video && (dec->video_idle || (dec->resume_index >= 0))) {
+    err = resume_video_decoder(dec, fsc);
+    if (err < 0) return GANG_FITAL;
+
+    dec->resume_index = err ? fs_index : -1;
+
+    if (dec->resume_index >= 0) return GANG_ERROR_DATA;
+  }
+
+  if (fsc->is_video && !rec_transcodes(dec, fsc) && skip_video_packet(dec)) {
+    return GANG_ERROR_DATA;
+  }
+
+  // Key only mode went on or off, and this packet is decoded.
+  if (fsc->is_video && dec->out_fps && (video_key_only(dec) != dec->filter_key_only) &&
+      (reset_video_filter(dec, fsc) < 0)) {
+    return GANG_FITAL;
+  }
+
+  if (fsc->is_video) update_video_discard(dec, fsc);
+
+  av_packet_rescale_ts(&dec->i_pkt, is->time_base, is->codec->time_base);
+
+  // Every ready frame was received before, so the decoder takes it.
+  err = avcodec_send_packet(is->codec, &dec->i_pkt);
+
+  if (err < 0) {
+    LOG_INFO("Decode failed");
+    return GANG_ERROR_DATA;
+  }
+  dec->drain_index = fs_index;
+  return receive_frame(dec, fsc);
+}
+
+// The input ended, each consumed decoder is flushed and gives out the
+// frames it still holds, one after the other over the next steps.
+// return: as gang_decode_next_frame, GANG_FITAL once all are empty
+static int flush_decoders(gang_decoder *dec) {
+  FilterStreamContext *fsc;
+
+  while (dec->flush_index < dec->fsc_size) {
+    fsc = &dec->fscs[dec->flush_index++];
+
+    if (!stream_consumed(dec, fsc) || (fsc->is_video && dec->video_idle)) continue;
+
+    if (avcodec_send_packet(fsc->is->codec, NULL) < 0) continue;
+
+    dec->drain_index = fsc - dec->fscs;
+    return receive_frame(dec, fsc);
+  }
+  return GANG_FITAL;
+}
+
+int gang_decoder_draining(gang_decoder *dec) {
+  return (dec->drain_index >= 0) || (dec->flush_index >= 0) || audio_block_ready(dec);
+}
+
+int gang_decoder_resuming(gang_decoder *dec) {
+  return dec->resume_index >= 0;
+}
+
 /**
  * return: -1->FITAL, 0->error, 1->video, 2->audio
  */
 int gang_decode_next_frame(gang_decoder *dec) {
-  FilterStreamContext fsc;
-  AVStream           *is;
-  int                 got_frame;
-  int                 fs_index;
-
-  int (*dec_func)(AVCodecContext *,
-                  AVFrame *,
-                  int *,
-                  const AVPacket *);
-  int err;
+  FilterStreamContext *fsc;
+  int                  fs_index;
+  int                  err;
+
+  if (!dec->ifmt_ctx) {
+    return GANG_FITAL;
+  }
+
+  // Frames of the last packet come first, threaded decoders output several
+  // at a time, and an audio frame holds more than one block.
+  if (audio_block_ready(dec)) {
+    return next_audio_block(dec);
+  }
+
+  if (dec->drain_index >= 0) {
+    return receive_frame(dec, &dec->fscs[dec->drain_index]);
+  }
+
+  if (dec->resume_index >= 0) {
+    return decode_packet(dec, dec->resume_index);
+  }
+
+  if (dec->flush_index >= 0) {
+    return flush_decoders(dec);
+  }
 
   av_packet_unref(&dec->i_pkt);
   av_init_packet(&dec->i_pkt);
 
-  if (!dec->ifmt_ctx || (av_read_frame(dec->ifmt_ctx, &dec->i_pkt) < 0)) {
-    LOG_ERROR("av_read_frame error!");
+  err = read_packet(dec);
+  if (err == AVERROR(EAGAIN)) {
+    return GANG_ERROR_DATA;
+  }
 
-    // TODO AVERROR_EOF?
+  if (err == AVERROR_EOF) {
+    LOG_INFO("End of input '%s'", dec->url);
+    dec->flush_index = 0;
+    return flush_decoders(dec);
+  }
+
+  if (err < 0) {
+    LOG_ERROR("av_read_frame error!");
     return GANG_FITAL;
   }
 
@@ -309,30 +1134,90 @@ int gang_decode_next_frame(gang_decoder *dec) {
     return GANG_ERROR_DATA;
   }
 
-  fsc = dec->fscs[fs_index];
-  is  = fsc.is;
+  fsc = &dec->fscs[fs_index];
 
-  av_packet_rescale_ts(&dec->i_pkt, is->time_base, is->codec->time_base);
-  av_frame_unref(dec->i_frame);
-  dec_func = fsc.is_video ? avcodec_decode_video2 : avcodec_decode_audio4;
-  err      = dec_func(is->codec, dec->i_frame, &got_frame, &dec->i_pkt);
+  if (gop_cache_put(&dec->gop_cache, &dec->i_pkt) < 0) {
+    LOG_INFO("gop_cache_put error");
+  }
 
-  if (err < 0) {
-    LOG_INFO("Decode failed");
-    return GANG_ERROR_DATA;
+  if (dec->recording && fsc->copy && (copy_write_packet(dec, fsc, &dec->i_pkt) < 0)) {
+    LOG_ERROR("copy_write_packet error");
+    return GANG_FITAL;
   }
 
-  if (got_frame) {
-    dec->i_frame->pts = av_frame_get_best_effort_timestamp(dec->i_frame);
-    err               = filter_encode_write_frame(dec, &fsc, 1);
+  return decode_packet(dec, fs_index);
+}
+
+// Start a copy recording with the current GOP instead of waiting for the
+// next keyframe.
+static int write_gop_cache(gang_decoder *dec) {
+  GopCache *c = &dec->gop_cache;
+  int       fs_index;
+  int       i;
+  int       ret;
 
-    if (err < 0) return GANG_FITAL;
-    if (fsc.is_video && dec->video_buff) return GANG_VIDEO_DATA;
-    if (!fsc.is_video && dec->audio_buff) return GANG_AUDIO_DATA;
-    LOG_DEBUG("Unexpected type");
+  for (i = 0; i < c->size; i++) {
+    if (find_fs_index(&fs_index, dec->fscs, dec->fsc_size, c->pkts[i].stream_index) < 0) continue;
+
+    if (!dec->fscs[fs_index].copy) continue;
+
+    ret = copy_write_packet(dec, &dec->fscs[fs_index], &c->pkts[i]);
+    if (ret < 0) return ret;
   }
+  return 0;
+}
 
-  return GANG_ERROR_DATA;
+int start_gang_rec(gang_decoder *dec) {
+  int err;
+
+  if (dec->recording) {
+    return 0;
+  }
+
+  // Leftover of a failed start.
+  close_output_streams(dec);
+  audio_chunker_reset(&dec->audio_chunker, AUDIO_CHUNK_REC);
+  dec->silent_ms = 0;
+  dec->waitkey   = 1;
+
+  err = open_output_streams(dec, 1);
+
+  if (!err && dec->gop_cache.valid) {
+    // The video decoder already holds the references of this GOP, so
+    // transcoded streams need not wait either.
+    dec->waitkey = 0;
+    err          = write_gop_cache(dec);
+  }
+
+  if (err) {
+    LOG_ERROR("Could not start recording");
+    close_output_streams(dec);
+  }
+  return err;
+}
+
+// Unlike flush_gang_rec_encoder, the filters are not flushed, they keep
+// feeding live delivery.
+int stop_gang_rec(gang_decoder *dec) {
+  int i;
+  int ret = 0;
+
+  if (dec->recording) {
+    for (i = 0; i < dec->fsc_size; i++) {
+      ret = flush_encoder(dec, &dec->fscs[i]);
+      if (ret < 0) {
+        LOG_INFO("Flushing encoder failed");
+        break;
+      }
+    }
+
+    ret = av_write_trailer(dec->ofmt_ctx);
+    if (ret) LOG_ERROR("Error occurred when trail output file");
+    dec->recording = 0;
+  }
+  dec->waitkey = 1;
+  close_output_streams(dec);
+  return ret;
 }
 
 int flush_gang_rec_encoder(gang_decoder *dec) {
@@ -345,14 +1230,13 @@ int flush_gang_rec_encoder(gang_decoder *dec) {
 
   /* flush filters and encoders */
   for (i = 0; i < dec->fsc_size; i++) {
-    /* flush filter */
-    if (!dec->fscs[i].filter_graph) {
-      continue;
-    }
-    ret = filter_encode_write_frame(dec, &dec->fscs[i], 0);
-    if (ret < 0) {
-      LOG_INFO("Flushing filter failed");
-      break;
+    /* flush filter, audio has none */
+    if (dec->fscs[i].filter_graph) {
+      ret = filter_encode_write_frame(dec, &dec->fscs[i], 0);
+      if (ret < 0) {
+        LOG_INFO("Flushing filter failed");
+        break;
+      }
     }
 
     /* flush encoder */
@@ -11,9 +11,38 @@ extern "C" {
 #define GANG_VIDEO_DATA 1
 #define GANG_AUDIO_DATA 2
 
+// How long gang_decode_next_frame waits for the reader before giving up the
+// step with GANG_ERROR_DATA, unless set_gang_decoder_read_wait says otherwise.
+#define GANG_PKT_QUEUE_WAIT_MS 100
+
+// Default bounds of blocking input calls, a dead camera fails the decoder
+// instead of hanging its thread.
+#define GANG_IO_OPEN_TIMEOUT_MS 10000
+#define GANG_IO_READ_TIMEOUT_MS 5000
+
+// Video decoder threads unless set_gang_decoder_threads says otherwise.
+// Slice threading only, frame threading holds a frame back per thread.
+#define GANG_VIDEO_THREADS 2
+
+// Audio levels are published this often.
+#define GANG_LEVEL_WINDOW_MS 100
+
+// Recorded audio under this RMS is silent, once it has lasted the hold
+// the rest of the stretch is handled by the silence mode.
+#define GANG_SILENCE_DBFS    -60
+#define GANG_SILENCE_HOLD_MS 300
+
+// Cached packets decoded per step when video resumes, a long GOP does not
+// hold up its thread.
+#define GANG_RESUME_STEP_PKTS 25
+
 void          initialize_gang_decoder_globel();
 void          cleanup_gang_decoder_globel();
 
+// Keep probed stream info of every url under dir, so reopening a known
+// input skips most of avformat_find_stream_info. NULL turns it off.
+void          set_gang_stream_info_cache_dir(const char *dir);
+
 // create gang_decode with given url
 gang_decoder* new_gang_decoder(const char *url,
                                const char *rec_name,
@@ -23,8 +52,139 @@ gang_decoder* new_gang_decoder(const char *url,
 // free gang_decoder
 void free_gang_decoder(gang_decoder *dec);
 
+// Read input on a dedicated thread into a queue of size packets.
+// policy is a PacketQueuePolicy. size 0 reads on the decode thread.
+// Takes effect at the next open_gang_decoder.
+void    set_gang_decoder_pkt_queue(gang_decoder *dec,
+                                   int           size,
+                                   int           policy);
+
+// How long a step waits for the reader when the packet queue is empty,
+// 0 returns at once. Defaults to GANG_PKT_QUEUE_WAIT_MS.
+void    set_gang_decoder_read_wait(gang_decoder *dec,
+                                   int           ms);
+
+// Add a width x height rendition of the video, scaled from the same decode.
+// Before init_gang_av_info.
+// return: index of the rendition from 1, <0->error
+int     add_gang_decoder_rendition(gang_decoder *dec,
+                                   int           width,
+                                   int           height);
+
+// Scale the video to width x height and drop it to fps in the filter
+// graph, 0 keeps the source value. Never scales up, and is ignored while
+// a transcoded recording needs the source. Takes effect at the next
+// open_gang_decoder.
+void    set_gang_decoder_video_format(gang_decoder *dec,
+                                      int           width,
+                                      int           height,
+                                      int           fps);
+
+// What the consumers want of the video, demand is a GangVideoDemand and
+// skip drops the next decoded frame before filtering. A transcoded
+// recording still gets every frame. From the decode thread, before
+// gang_decode_next_frame.
+void    set_gang_decoder_video_demand(gang_decoder *dec,
+                                      int           demand,
+                                      int           skip);
+
+// Decode only video keyframes for low rate previews, other packets are
+// dropped before the decoder. Demuxing and recording still see all of
+// them, a transcoded recording has every frame decoded but only keyframes
+// delivered. Can be called from any thread.
+void    set_gang_decoder_key_only(gang_decoder *dec,
+                                  int           key_only);
+int     gang_decoder_key_only(gang_decoder *dec);
+
+// Stretch delivered audio by ppm parts per million against the drift of
+// the consumer clock, the recording is not touched. Can be called from
+// any thread, applied from the next decoded frame.
+void    set_gang_decoder_audio_compensation(gang_decoder *dec,
+                                            int           ppm);
+
+// Source time in us of the first sample of the audio block just returned,
+// AV_NOPTS_VALUE when not known. On the decode thread.
+int64_t gang_decoder_audio_time(gang_decoder *dec);
+
+// Decode audio for its level even when nothing else takes it.
+// Call before open.
+void    set_gang_decoder_level_wanted(gang_decoder *dec,
+                                      int           wanted);
+
+// Take the audio level of the last GANG_LEVEL_WINDOW_MS, in dBFS.
+// On the decode thread. return: 1 once per window, 0 while none is new
+int     gang_decoder_audio_level(gang_decoder *dec,
+                                 int          *rms_dbfs,
+                                 int          *peak_dbfs);
+
+// Leave out or write as empty frames the silent stretches of a transcoded
+// recording instead of encoding them, mode is a GangSilenceMode. Silence
+// is an RMS under dbfs. Takes effect from the next recorded frame.
+void    set_gang_decoder_rec_silence(gang_decoder *dec,
+                                     int           mode,
+                                     int           dbfs);
+
+// Encoder settings of recorded audio. The recording takes audio in frames
+// of the size the encoder opens with, so any frame duration fits. dtx
+// turns on GANG_SILENCE_DTX. Takes effect at the next recording start.
+void    set_gang_decoder_audio_profile(gang_decoder           *dec,
+                                       const GangAudioProfile *profile);
+
+// Threads of the video decoder, 0 picks one per core. Slices are decoded
+// in parallel, frame threading is on only when frame_threads is set: it
+// delays each frame by a frame per extra thread, threads-1 frame durations
+// of latency. Takes effect at the next open.
+void    set_gang_decoder_threads(gang_decoder *dec,
+                                 int           threads,
+                                 int           frame_threads);
+
+// Bound opening+probing and each packet read, 0 waits forever.
+// Takes effect at the next open.
+void    set_gang_decoder_io_timeout(gang_decoder *dec,
+                                    int           open_ms,
+                                    int           read_ms);
+
+// Interrupt any blocking input call now and fail the later ones.
+// Can be called from any thread, the decoder can only be closed after.
+void    abort_gang_decoder(gang_decoder *dec);
+
+// Record input packets as they are, transcoding only the streams the muxer
+// can not take. Takes effect at the next open_gang_decoder.
+void    set_gang_decoder_rec_copy(gang_decoder *dec,
+                                  int           rec_copy);
+
+// Keep the input probed by init_gang_av_info open for ms, so that
+// open_gang_decoder can reuse it instead of connecting and probing again.
+void    set_gang_decoder_keep_warm(gang_decoder *dec,
+                                   int           ms);
+
+// Keep up to max_pkts packets since the last video keyframe, so new
+// recordings start without waiting for the next one. 0 disables it.
+// Takes effect at the next open_gang_decoder.
+void    set_gang_decoder_gop_cache(gang_decoder *dec,
+                                   int           max_pkts);
+
+// Can be called from any thread.
+int     gang_pkt_queue_occupancy(gang_decoder *dec);
+int64_t gang_pkt_queue_dropped(gang_decoder *dec);
+
+// From the decode thread once a step got nothing from the reader. notify is
+// called once on the reader thread when input is there, see
+// packet_queue_arm.
+// return: 1->armed, 0->step again now
+int     gang_decoder_arm_input(gang_decoder     *dec,
+                               PacketQueueNotify notify,
+                               void             *opaque);
+
+// Probe the input. With keep_warm, the input stays open for
+// open_gang_decoder until release_gang_warm_input.
 int  init_gang_av_info(gang_decoder *dec);
 
+// Close the input probed by init_gang_av_info if it was not reused by
+// open_gang_decoder, when force or when it is past its keep warm time.
+void release_gang_warm_input(gang_decoder *dec,
+                             int           force);
+
 // Init all buffer and data that are needed by dec.
 // return error
 int  open_gang_decoder(gang_decoder *dec);
@@ -32,8 +192,12 @@ int  open_gang_decoder(gang_decoder *dec);
 // Free all memo that opened by open_gang_decoder.
 void close_gang_decoder(gang_decoder *dec);
 
-// Read a single frame.
+// Read a single frame. A packet that decodes to several frames returns
+// them over the next calls, see gang_decoder_draining. At the end of the
+// input the frames the decoders still hold come out before -1.
 // If data==NULL, then no copy operate will be exec.
+// If video_by_ref, video is not copied but referenced in video_frame,
+// which stays valid until the next call.
 // Support: I420, YUY2, UYVY, ARGB.
 // I420 will not be converted again, other format will not be supported
 // until changing the api(open_gang_decoder) to output the format to c++.
@@ -44,8 +208,30 @@ void close_gang_decoder(gang_decoder *dec);
 // return: -1->EOF, 0->error, 1->video, 2->audio
 int gang_decode_next_frame(gang_decoder *dec);
 
+// A step decoded a packet to more frames than it returned, or the input
+// ended, the next steps return them before reading again.
+int gang_decoder_draining(gang_decoder *dec);
+
+// The video decoder is catching up on the cached GOP, the next steps
+// continue it without waiting for input.
+int gang_decoder_resuming(gang_decoder *dec);
+
+// Copy a video frame into buff of buff_size bytes, sized from
+// video_buff_size for the main output or the buff_size of its rendition.
+// return: AVERROR(ENOSPC)->the frame does not fit, <0->error
+int gang_copy_video_frame(const AVFrame *frame,
+                          uint8_t       *buff,
+                          int            buff_size);
+
 int flush_gang_rec_encoder(gang_decoder *dec);
 
+// Open a new record file on an opened decoder, the input keeps running.
+// return error
+int start_gang_rec(gang_decoder *dec);
+
+// Finish and close the record file, the input keeps running.
+int stop_gang_rec(gang_decoder *dec);
+
 #ifdef __cplusplus
 } // closing brace for extern "C"
 #endif // ifdef __cplusplus
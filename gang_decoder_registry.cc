@@ -0,0 +1,158 @@
+#include "gang_decoder_registry.h"
+
+#include <algorithm>
+
+#include "gang_spdlog_console.h"
+
+namespace gang {
+GangDecoderRegistry::GangDecoderRegistry(Thread *worker_thread, GangScheduler *scheduler) :
+  worker_thread_(worker_thread),
+  scheduler_(scheduler) {}
+
+GangDecoderRegistry::~GangDecoderRegistry() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!decoders_.empty()) {
+    console->error("{}: {} decoders still in use", __func__, decoders_.size());
+  }
+}
+
+shared_ptr<GangDecoder> GangDecoderRegistry::Acquire(const std::string& url,
+                                                     const std::string& rec_name,
+                                                     bool               rec_enabled,
+                                                     bool               audio_off) {
+  const Key               key(url, audio_off);
+  shared_ptr<GangDecoder> decoder;
+  bool                    shared = true;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto                        it = decoders_.find(key);
+
+    if (it != decoders_.end()) decoder = it->second.decoder.lock();
+
+    if (decoder && (rec_name.empty() || (rec_name == it->second.rec_name))) {
+      if (rec_enabled) decoder->SetRecordEnabled(true);
+      SPDLOG_TRACE(console, "{}: shared {}", __func__, url)
+      return decoder;
+    }
+
+    if (decoder) {
+      console->warn("{}: {} records to {}, open another session", __func__, url,
+                    it->second.rec_name);
+      shared = false;
+    }
+  }
+
+  // Probe without the lock, Init can take up to the open timeout. Statuses
+  // are per url, a private decoder would overwrite the shared one's.
+  GangDecoder *raw = new GangDecoder(url, url, rec_name, rec_enabled, audio_off,
+                                     worker_thread_, shared ? this : NULL, scheduler_);
+
+  if (!raw->Init()) {
+    delete raw;
+    return shared_ptr<GangDecoder>();
+  }
+
+  if (!shared) {
+    return shared_ptr<GangDecoder>(raw);
+  }
+  decoder.reset(raw, [this, key](GangDecoder *d) {
+    Release(key, d);
+  });
+
+  shared_ptr<GangDecoder> winner;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry&                      entry = decoders_[key];
+
+    winner = entry.decoder.lock();
+
+    if (!winner) {
+      entry.decoder  = decoder;
+      entry.raw      = raw;
+      entry.rec_name = rec_name;
+      return decoder;
+    }
+
+    if (!rec_name.empty() && (rec_name != entry.rec_name)) {
+      decoder->SetStatusObserver(NULL);
+      return decoder;
+    }
+  }
+
+  // Lost a race with another Acquire of the same url, use its decoder.
+  decoder.reset();
+
+  if (rec_enabled) winner->SetRecordEnabled(true);
+  return winner;
+}
+
+void GangDecoderRegistry::Release(const Key& key, GangDecoder *decoder) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto                        it = decoders_.find(key);
+
+    // The entry may already belong to a decoder opened after this one.
+    if ((it != decoders_.end()) && (it->second.raw == decoder)) {
+      decoders_.erase(it);
+    }
+  }
+  SPDLOG_TRACE(console, "{}: {}", __func__, key.first)
+
+  // Shuts the input down, the last user is gone.
+  delete decoder;
+
+  // After the delete, which may still report a status. The other audio_off
+  // decoder of the url keeps it.
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if ((decoders_.find(Key(key.first, !key.second)) == decoders_.end()) &&
+      (decoders_.find(key) == decoders_.end())) {
+    statuses_.erase(key.first);
+  }
+}
+
+void GangDecoderRegistry::AddStatusObserver(StatusObserver *observer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  observers_.push_back(observer);
+}
+
+void GangDecoderRegistry::RemoveStatusObserver(StatusObserver *observer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  observers_.erase(std::remove(observers_.begin(), observers_.end(), observer),
+                   observers_.end());
+}
+
+bool GangDecoderRegistry::GetStatus(const std::string& url, GangStatus *status) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto                        it = statuses_.find(url);
+
+  if (it == statuses_.end()) {
+    return false;
+  }
+  *status = it->second;
+  return true;
+}
+
+size_t GangDecoderRegistry::Size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  return decoders_.size();
+}
+
+void GangDecoderRegistry::OnStatusChange(const std::string& url, GangStatus status) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto                        it = statuses_.find(url);
+
+  if ((it != statuses_.end()) && (it->second == status)) {
+    return;
+  }
+  statuses_[url] = status;
+
+  for (auto observer : observers_) {
+    observer->OnStatusChange(url, status);
+  }
+}
+} // namespace gang
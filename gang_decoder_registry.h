@@ -0,0 +1,68 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "gang_decoder.h"
+
+namespace gang {
+using std::shared_ptr;
+
+// Hands out one shared GangDecoder per url, so every user of a camera
+// shares its session and its decode. The decoder is shut down when the
+// last handle goes away. Thread safe, and it must outlive its handles.
+class GangDecoderRegistry : public StatusObserver {
+public:
+  explicit GangDecoderRegistry(Thread        *worker_thread,
+                               GangScheduler *scheduler = NULL);
+  ~GangDecoderRegistry();
+
+  // Returns the open decoder of url, or a new one after Init succeeds.
+  // A decoder already recording to another rec_name is not compatible,
+  // such a caller gets a decoder of its own, which reports no status.
+  // rec_enabled turns recording on for a shared decoder too. NULL when
+  // Init fails.
+  shared_ptr<GangDecoder> Acquire(const std::string& url,
+                                  const std::string& rec_name,
+                                  bool               rec_enabled,
+                                  bool               audio_off);
+
+  // Observers get one status per url, only when it changes. They are
+  // called on gang threads with the registry locked, so must not call it.
+  void AddStatusObserver(StatusObserver *observer);
+  void RemoveStatusObserver(StatusObserver *observer);
+
+  // return: false when url has no status yet, or no decoder left
+  bool GetStatus(const std::string& url,
+                 GangStatus        *status);
+
+  size_t Size();
+
+  virtual void OnStatusChange(const std::string& url,
+                              GangStatus         status);
+
+private:
+  typedef std::pair<std::string, bool> Key; // url, audio_off
+
+  struct Entry {
+    std::weak_ptr<GangDecoder> decoder;
+    GangDecoder               *raw;
+    std::string                rec_name;
+  };
+
+  void Release(const Key&   key,
+               GangDecoder *decoder);
+
+  Thread                           *worker_thread_;
+  GangScheduler                    *scheduler_;
+  std::mutex                        mutex_;
+  std::map<Key, Entry>              decoders_;
+  std::map<std::string, GangStatus> statuses_;
+  std::vector<StatusObserver *>     observers_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(GangDecoderRegistry);
+};
+} // namespace gang
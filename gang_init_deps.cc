@@ -16,4 +16,8 @@ void CleanupGangDecoderGlobel() {
   ::cleanup_gang_decoder_globel();
   CleanupGangSpdlog();
 }
+
+void SetGangStreamInfoCacheDir(const std::string& dir) {
+  ::set_gang_stream_info_cache_dir(dir.c_str());
+}
 } // namespace gang
@@ -1,7 +1,12 @@
 #pragma once
 
+#include <string>
+
 namespace gang {
 void InitializeGangDecoderGlobel();
 
 void CleanupGangDecoderGlobel();
+
+// Directory for cached stream info, empty turns it off.
+void SetGangStreamInfoCacheDir(const std::string& dir);
 } // namespace gang
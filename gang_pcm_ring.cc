@@ -0,0 +1,56 @@
+#include "gang_pcm_ring.h"
+
+#include <string.h>
+
+namespace gang {
+PcmRing::PcmRing(size_t capacity) :
+  buff_(new uint8_t[capacity]),
+  capacity_(capacity),
+  write_pos_(0),
+  read_pos_(0) {}
+
+bool PcmRing::Write(const uint8_t *data, size_t len) {
+  const size_t w = write_pos_.load(std::memory_order_relaxed);
+  const size_t r = read_pos_.load(std::memory_order_acquire);
+
+  if (capacity_ - (w - r) < len) {
+    return false;
+  }
+  const size_t offset = w % capacity_;
+  const size_t first  = len < capacity_ - offset ? len : capacity_ - offset;
+
+  memcpy(buff_.get() + offset, data,         first);
+  memcpy(buff_.get(),          data + first, len - first);
+  write_pos_.store(w + len, std::memory_order_release);
+  return true;
+}
+
+bool PcmRing::Read(uint8_t *data, size_t len) {
+  const size_t r = read_pos_.load(std::memory_order_relaxed);
+  const size_t w = write_pos_.load(std::memory_order_acquire);
+
+  if (w - r < len) {
+    return false;
+  }
+  const size_t offset = r % capacity_;
+  const size_t first  = len < capacity_ - offset ? len : capacity_ - offset;
+
+  memcpy(data,         buff_.get() + offset, first);
+  memcpy(data + first, buff_.get(),          len - first);
+  read_pos_.store(r + len, std::memory_order_release);
+  return true;
+}
+
+void PcmRing::Skip(size_t len) {
+  const size_t r = read_pos_.load(std::memory_order_relaxed);
+  const size_t w = write_pos_.load(std::memory_order_acquire);
+
+  read_pos_.store(r + (w - r < len ? w - r : len), std::memory_order_release);
+}
+
+size_t PcmRing::Size() const {
+  const size_t r = read_pos_.load(std::memory_order_acquire);
+
+  return write_pos_.load(std::memory_order_acquire) - r;
+}
+} // namespace gang
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include "webrtc/base/basictypes.h"
+#include "webrtc/base/constructormagic.h"
+#include "webrtc/base/scoped_ptr.h"
+
+namespace gang {
+// Lock-free single-producer/single-consumer byte ring for interleaved PCM.
+// One thread only writes, another only reads; Size can be called from both.
+class PcmRing {
+public:
+  explicit PcmRing(size_t capacity);
+
+  // Producer. Writes all len bytes or nothing when there is no room.
+  bool   Write(const uint8_t *data,
+               size_t         len);
+
+  // Consumer. Reads exactly len bytes or nothing when not enough buffered.
+  bool   Read(uint8_t *data,
+              size_t   len);
+
+  // Consumer. Discards up to len buffered bytes.
+  void   Skip(size_t len);
+
+  size_t Size() const;
+  size_t Capacity() const {return capacity_;}
+
+private:
+  rtc::scoped_ptr<uint8_t[]> buff_;
+  const size_t               capacity_;
+  std::atomic<size_t>        write_pos_; // written by producer only
+  std::atomic<size_t>        read_pos_;  // written by consumer only
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(PcmRing);
+};
+} // namespace gang
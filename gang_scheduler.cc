@@ -0,0 +1,430 @@
+#include "gang_scheduler.h"
+
+#include "webrtc/base/checks.h"
+
+#include "gang_spdlog_console.h"
+
+namespace gang {
+namespace {
+// Messages a strand handles before it goes back to the end of a queue.
+const int kStrandBatch = 8;
+
+// Threads for Offload, each open of an input may hold one for its timeout.
+const int kBlockingThreads = 4;
+
+// Worker index of the calling thread, -1 outside the pool.
+thread_local int         current_worker = -1;
+thread_local GangStrand *current_strand = NULL;
+
+void DeleteData(rtc::Message *msg) {
+  delete msg->pdata;
+  msg->pdata = NULL;
+}
+} // namespace
+
+GangStrand::GangStrand(GangScheduler *scheduler, rtc::MessageHandler *handler) :
+  scheduler_(scheduler),
+  handler_(handler),
+  queued_(false),
+  running_(false),
+  suspended_(false),
+  quitting_(false) {}
+
+GangStrand::~GangStrand() {
+  for (auto& msg : ready_) DeleteData(&msg);
+
+  for (auto& it : delayed_) DeleteData(&it.second);
+}
+
+void GangStrand::Post(uint32 id, rtc::MessageData *data) {
+  rtc::Message msg;
+  bool         schedule = false;
+
+  msg.phandler   = handler_;
+  msg.message_id = id;
+  msg.pdata      = data;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (quitting_) {
+      DeleteData(&msg);
+      return;
+    }
+    ready_.push_back(msg);
+
+    if (!queued_ && !suspended_) {
+      queued_  = true;
+      schedule = true;
+    }
+  }
+
+  if (schedule) scheduler_->Schedule(shared_from_this());
+}
+
+void GangStrand::PostDelayed(int cms, uint32 id, rtc::MessageData *data) {
+  Clock::time_point due = Clock::now() + std::chrono::milliseconds(cms);
+  rtc::Message      msg;
+
+  if (cms <= 0) {
+    Post(id, data);
+    return;
+  }
+  msg.phandler   = handler_;
+  msg.message_id = id;
+  msg.pdata      = data;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (quitting_) {
+      DeleteData(&msg);
+      return;
+    }
+    delayed_.insert(std::make_pair(due, msg));
+  }
+  scheduler_->ScheduleAt(due, shared_from_this());
+}
+
+void GangStrand::Clear(uint32 id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  for (auto it = ready_.begin(); it != ready_.end();) {
+    if ((id == rtc::MQID_ANY) || (it->message_id == id)) {
+      DeleteData(&*it);
+      it = ready_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  for (auto it = delayed_.begin(); it != delayed_.end();) {
+    if ((id == rtc::MQID_ANY) || (it->second.message_id == id)) {
+      DeleteData(&it->second);
+      it = delayed_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+bool GangStrand::IsCurrent() const {
+  return current_strand == this;
+}
+
+void GangStrand::Quit() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  quitting_ = true;
+
+  for (auto& it : delayed_) DeleteData(&it.second);
+  delayed_.clear();
+}
+
+bool GangStrand::IsQuitting() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  return quitting_;
+}
+
+void GangStrand::Stop() {
+  DCHECK(!IsCurrent());
+  Quit();
+
+  // Drain here rather than wait for a worker, the caller may be one.
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (running_ || suspended_ || !ready_.empty()) {
+    if (running_ || suspended_) {
+      idle_cv_.wait(lock);
+      continue;
+    }
+    rtc::Message msg = ready_.front();
+
+    ready_.pop_front();
+    running_ = true;
+    lock.unlock();
+    Dispatch(&msg);
+    lock.lock();
+    running_ = false;
+  }
+  handler_ = NULL;
+}
+
+void GangStrand::Offload(const std::function<void()>& task, uint32 done_id) {
+  std::shared_ptr<GangStrand> self = shared_from_this();
+
+  DCHECK(IsCurrent());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    suspended_ = true;
+  }
+  scheduler_->RunBlocking([self, task, done_id] {
+    task();
+    self->Resume(done_id);
+  });
+}
+
+// Even when quitting, Stop waits for done_id.
+void GangStrand::Resume(uint32 done_id) {
+  rtc::Message msg;
+  bool         schedule = false;
+
+  msg.message_id = done_id;
+  msg.pdata      = NULL;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    msg.phandler = handler_;
+    ready_.push_front(msg);
+    suspended_ = false;
+
+    // Still in Run when the task was quick, it goes on by itself.
+    if (!queued_) {
+      queued_  = true;
+      schedule = true;
+    }
+    idle_cv_.notify_all();
+  }
+
+  if (schedule) scheduler_->Schedule(shared_from_this());
+}
+
+void GangStrand::Dispatch(rtc::Message *msg) {
+  GangStrand *prev = current_strand;
+
+  current_strand = this;
+  msg->phandler->OnMessage(msg);
+  current_strand = prev;
+}
+
+void GangStrand::PromoteDue(Clock::time_point now) {
+  while (!delayed_.empty() && (delayed_.begin()->first <= now)) {
+    ready_.push_back(delayed_.begin()->second);
+    delayed_.erase(delayed_.begin());
+  }
+}
+
+void GangStrand::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  // Stop is draining on its own thread.
+  if (running_ || !handler_) {
+    queued_ = false;
+    return;
+  }
+  running_ = true;
+  PromoteDue(Clock::now());
+
+  for (int i = 0; i < kStrandBatch && !ready_.empty() && !suspended_; i++) {
+    rtc::Message msg = ready_.front();
+
+    ready_.pop_front();
+    lock.unlock();
+    Dispatch(&msg);
+    lock.lock();
+  }
+  running_ = false;
+  PromoteDue(Clock::now());
+
+  if (ready_.empty() || suspended_) {
+    queued_ = false;
+  }
+  idle_cv_.notify_all();
+
+  if (queued_) {
+    lock.unlock();
+    scheduler_->Schedule(shared_from_this());
+  }
+}
+
+void GangStrand::Wake() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    PromoteDue(Clock::now());
+
+    if (queued_ || suspended_ || ready_.empty() || !handler_) {
+      return;
+    }
+    queued_ = true;
+  }
+  scheduler_->Schedule(shared_from_this());
+}
+
+GangScheduler::GangScheduler(int workers) :
+  next_(0),
+  pending_(0),
+  quit_(false),
+  blocking_quit_(false) {
+  size_t n = workers > 0 ? workers : std::thread::hardware_concurrency();
+
+  if (!n) n = 1;
+
+  for (size_t i = 0; i < n; i++) {
+    workers_.push_back(std::unique_ptr<Worker>(new Worker()));
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    workers_[i]->thread = std::thread(&GangScheduler::WorkerLoop, this, i);
+  }
+  timer_thread_ = std::thread(&GangScheduler::TimerLoop, this);
+
+  for (int i = 0; i < kBlockingThreads; i++) {
+    blocking_threads_.push_back(std::thread(&GangScheduler::BlockingLoop, this));
+  }
+  SPDLOG_TRACE(console, "{}: {} workers", __func__, n)
+}
+
+GangScheduler::~GangScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    quit_ = true;
+  }
+  idle_cv_.notify_all();
+  {
+    std::lock_guard<std::mutex> lock(timer_mutex_);
+    timer_cv_.notify_all();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(blocking_mutex_);
+    blocking_quit_ = true;
+  }
+  blocking_cv_.notify_all();
+
+  for (auto& worker : workers_) worker->thread.join();
+  timer_thread_.join();
+  timers_.clear();
+
+  for (auto& thread : blocking_threads_) thread.join();
+}
+
+std::shared_ptr<GangStrand> GangScheduler::CreateStrand(rtc::MessageHandler *handler) {
+  return std::shared_ptr<GangStrand>(new GangStrand(this, handler));
+}
+
+void GangScheduler::Schedule(const StrandPtr& strand) {
+  // Keep work posted from a worker on that worker, others steal if idle.
+  size_t self = current_worker >= 0 ? current_worker :
+                next_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+  {
+    std::lock_guard<std::mutex> lock(workers_[self]->mutex);
+    workers_[self]->queue.push_back(strand);
+  }
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    pending_++;
+  }
+  idle_cv_.notify_one();
+}
+
+void GangScheduler::RunBlocking(const std::function<void()>& task) {
+  {
+    std::lock_guard<std::mutex> lock(blocking_mutex_);
+    blocking_.push_back(task);
+  }
+  blocking_cv_.notify_one();
+}
+
+void GangScheduler::ScheduleAt(Clock::time_point due, const StrandPtr& strand) {
+  std::lock_guard<std::mutex> lock(timer_mutex_);
+
+  if (timers_.empty() || (due < timers_.begin()->first)) {
+    timer_cv_.notify_one();
+  }
+  timers_.insert(std::make_pair(due, strand));
+}
+
+// Own queue from the front, others from the back.
+bool GangScheduler::Take(size_t self, StrandPtr *strand) {
+  for (size_t i = 0; i < workers_.size(); i++) {
+    Worker                     *worker = workers_[(self + i) % workers_.size()].get();
+    std::lock_guard<std::mutex> lock(worker->mutex);
+
+    if (worker->queue.empty()) continue;
+
+    if (!i) {
+      *strand = worker->queue.front();
+      worker->queue.pop_front();
+    } else {
+      *strand = worker->queue.back();
+      worker->queue.pop_back();
+    }
+    return true;
+  }
+  return false;
+}
+
+void GangScheduler::WorkerLoop(size_t self) {
+  StrandPtr strand;
+
+  current_worker = static_cast<int>(self);
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(idle_mutex_);
+      idle_cv_.wait(lock, [this] {
+        return quit_ || pending_;
+      });
+
+      if (quit_) break;
+
+      // Claimed, a strand is sitting in one of the queues for this worker.
+      pending_--;
+    }
+
+    while (!Take(self, &strand)) std::this_thread::yield();
+    strand->Run();
+    strand.reset();
+  }
+  current_worker = -1;
+}
+
+void GangScheduler::TimerLoop() {
+  std::unique_lock<std::mutex> lock(timer_mutex_);
+
+  while (true) {
+    {
+      std::lock_guard<std::mutex> idle(idle_mutex_);
+
+      if (quit_) break;
+    }
+
+    if (timers_.empty()) {
+      timer_cv_.wait(lock);
+      continue;
+    }
+    Clock::time_point due = timers_.begin()->first;
+
+    if (Clock::now() < due) {
+      timer_cv_.wait_until(lock, due);
+      continue;
+    }
+    StrandPtr strand = timers_.begin()->second;
+
+    timers_.erase(timers_.begin());
+    lock.unlock();
+    strand->Wake();
+    strand.reset();
+    lock.lock();
+  }
+}
+
+void GangScheduler::BlockingLoop() {
+  std::unique_lock<std::mutex> lock(blocking_mutex_);
+
+  while (true) {
+    blocking_cv_.wait(lock, [this] {
+      return blocking_quit_ || !blocking_.empty();
+    });
+
+    // Strands are stopped before, which waits for their tasks.
+    if (blocking_.empty()) break;
+    std::function<void()> task = blocking_.front();
+
+    blocking_.pop_front();
+    lock.unlock();
+    task();
+    lock.lock();
+  }
+}
+} // namespace gang
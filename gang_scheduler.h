@@ -0,0 +1,141 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "webrtc/base/basictypes.h"
+#include "webrtc/base/constructormagic.h"
+#include "webrtc/base/messagehandler.h"
+#include "webrtc/base/messagequeue.h"
+
+namespace gang {
+class GangScheduler;
+
+// Serial message queue run by the workers of a GangScheduler. Messages are
+// handled one at a time in post order, delayed ones once due, so to its
+// handler a strand looks like a thread of its own.
+class GangStrand : public std::enable_shared_from_this<GangStrand> {
+public:
+  ~GangStrand();
+
+  // Thread safe, the strand owns data.
+  void Post(uint32            id,
+            rtc::MessageData *data = NULL);
+  void PostDelayed(int               cms,
+                   uint32            id,
+                   rtc::MessageData *data = NULL);
+
+  // Drop pending messages of id, all of them for rtc::MQID_ANY.
+  void Clear(uint32 id);
+
+  // True while a message of this strand is handled on the calling thread.
+  bool IsCurrent() const;
+
+  // Accept no more messages and drop delayed ones, ready ones still run.
+  void Quit();
+  bool IsQuitting() const;
+
+  // Quit, wait for an Offload task, run what is still ready and detach the
+  // handler. Once it returns the handler is never called again. Not from
+  // the strand itself.
+  void Stop();
+
+  // Run task on a blocking thread of the scheduler, for calls that wait on
+  // the network. Until it returns the strand handles nothing else, then
+  // done_id comes before anything posted meanwhile. From the strand only.
+  void Offload(const std::function<void()>& task,
+               uint32                       done_id);
+
+private:
+  friend class GangScheduler;
+  typedef std::chrono::steady_clock Clock;
+
+  GangStrand(GangScheduler       *scheduler,
+             rtc::MessageHandler *handler);
+
+  // Called by the scheduler only.
+  void Run();
+  void Wake();
+
+  void PromoteDue(Clock::time_point now);
+  void Dispatch(rtc::Message *msg);
+  void Resume(uint32 done_id);
+
+  GangScheduler                               *scheduler_;
+  rtc::MessageHandler                         *handler_;
+  mutable std::mutex                           mutex_;
+  std::condition_variable                      idle_cv_;
+  std::deque<rtc::Message>                     ready_;
+  std::multimap<Clock::time_point, rtc::Message> delayed_;
+  bool                                         queued_;  // in a worker queue or running
+  bool                                         running_; // a handler is being called
+  bool                                         suspended_; // an Offload task is running
+  bool                                         quitting_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(GangStrand);
+};
+
+// Fixed pool of workers that runs many strands. Each worker takes strands
+// from its own queue first and steals from the others when it runs dry.
+// Blocking calls of strands go to a few threads of their own, see Offload.
+class GangScheduler {
+public:
+  // 0 workers uses one per core.
+  explicit GangScheduler(int workers = 0);
+
+  // Stop every strand before.
+  ~GangScheduler();
+
+  std::shared_ptr<GangStrand> CreateStrand(rtc::MessageHandler *handler);
+
+  int                         Workers() const {return static_cast<int>(workers_.size());}
+
+private:
+  friend class GangStrand;
+  typedef std::shared_ptr<GangStrand> StrandPtr;
+  typedef GangStrand::Clock           Clock;
+
+  struct Worker {
+    std::mutex            mutex;
+    std::deque<StrandPtr> queue;
+    std::thread           thread;
+  };
+
+  void Schedule(const StrandPtr& strand);
+  void ScheduleAt(Clock::time_point due,
+                  const StrandPtr & strand);
+  bool Take(size_t     self,
+            StrandPtr *strand);
+  void WorkerLoop(size_t self);
+  void TimerLoop();
+  void RunBlocking(const std::function<void()>& task);
+  void BlockingLoop();
+
+  std::vector<std::unique_ptr<Worker> > workers_;
+  std::atomic<size_t>                   next_;    // for posts from outside the pool
+  std::mutex                            idle_mutex_;
+  std::condition_variable               idle_cv_;
+  size_t                                pending_; // strands sitting in worker queues
+  bool                                  quit_;
+
+  std::mutex                            timer_mutex_;
+  std::condition_variable               timer_cv_;
+  std::multimap<Clock::time_point, StrandPtr> timers_;
+  std::thread                           timer_thread_;
+
+  std::mutex                            blocking_mutex_;
+  std::condition_variable               blocking_cv_;
+  std::deque<std::function<void()> >    blocking_;
+  std::vector<std::thread>              blocking_threads_;
+  bool                                  blocking_quit_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(GangScheduler);
+};
+} // namespace gang
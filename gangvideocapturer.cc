@@ -1,16 +1,32 @@
 #include "gangvideocapturer.h"
 
 #include "webrtc/base/bind.h"
+#include "webrtc/common_video/interface/video_frame_buffer.h"
+#include "talk/media/webrtc/webrtcvideoframe.h"
 #include "gang_spdlog_console.h"
 
 namespace gang {
-enum {VIDEO_START_OK, VIDEO_START_FAILED, VIDEO_STOPPED};
+enum {VIDEO_START_OK, VIDEO_START_FAILED, VIDEO_STOPPED, VIDEO_FRAME};
 
-VideoCapturer* CreateVideoCapturer(shared_ptr<GangDecoder> gang, rtc::Thread *thread) {
+// Heights advertised below the source one, widths keep its aspect.
+static const int kLadderHeights[] = {1080, 720, 540, 360, 270, 180};
+
+// Every size is also offered at this rate when the source is faster.
+static const int kLowFps = 15;
+
+// Rate advertised by a key frame only decoder, about one GOP a second.
+static const int kKeyOnlyFps = 1;
+
+// Called by webrtc when the wrapped buffer is no longer used.
+static void ReleaseFrame(AVFrame *frame) {
+  av_frame_free(&frame);
+}
+
+VideoCapturer* CreateVideoCapturer(shared_ptr<GangDecoder> gang, rtc::Thread *thread, int rendition) {
   if (!gang.get() || !thread) {
     return NULL;
   }
-  rtc::scoped_ptr<GangVideoCapturer> capturer(new GangVideoCapturer(gang, thread));
+  rtc::scoped_ptr<GangVideoCapturer> capturer(new GangVideoCapturer(gang, thread, rendition));
   if (!capturer.get()) {
     SPDLOG_TRACE(console, "{} {}", __func__, "error")
     return NULL;
@@ -40,6 +56,10 @@ public:
         capture_->onVideoStopped_s();
         break;
 
+      case VIDEO_FRAME:
+        capture_->onGangFrame_s();
+        break;
+
       default:
         ASSERT(false);
         break;
@@ -54,14 +74,18 @@ private:
   GangVideoCapturer *capture_;
 };
 
-GangVideoCapturer::GangVideoCapturer(shared_ptr<GangDecoder> gang, rtc::Thread *thread) :
+GangVideoCapturer::GangVideoCapturer(shared_ptr<GangDecoder> gang, rtc::Thread *thread, int rendition) :
   VideoCapturer(thread),
   owner_thread_(rtc::Thread::Current()),
   start_thread_(NULL),
   start_thread_handler_(new ThreadHandler(this)),
   gang_(gang),
+  rendition_(rendition),
   start_time_ns_(0),
+  last_frame_ns_(0),
+  source_interval_(0),
   drop_interval_(0),
+  pending_frame_(NULL),
   running_(false),
   accept_(false),
   current_state_(cricket::CS_STOPPED) {
@@ -76,13 +100,15 @@ GangVideoCapturer::~GangVideoCapturer() {
   crit_.Leave();
   SPDLOG_TRACE(console, "{} waited stopped ok", __func__)
   CHECK(!running_);
+
+  if (start_thread_) {
+    start_thread_->Clear(start_thread_handler_);
+  }
   delete start_thread_handler_;
   start_thread_handler_ = NULL;
 
-  if (captured_frame_.data) {
-    delete[] static_cast<char *>(captured_frame_.data);
-    captured_frame_.data = NULL;
-  }
+  AVFrame *pending = pending_frame_.exchange(NULL);
+  av_frame_free(&pending);
 
   // TODO Why this can fix RollingAccumulator segfault?
   cricket::VariableInfo<int>    adapt_frame_drops;
@@ -99,33 +125,42 @@ GangVideoCapturer::~GangVideoCapturer() {
 }
 
 void GangVideoCapturer::Initialize() {
-  int width;
-  int height;
-  int fps;
-
-  gang_->GetVideoInfo(&width, &height, &fps, &captured_frame_.data_size);
-  drop_interval_ = cricket::VideoFormat::FpsToInterval(fps) * 2 / 3;
-
-  captured_frame_.fourcc       = cricket::FOURCC_I420;
-  captured_frame_.pixel_height = 1;
-  captured_frame_.pixel_width  = 1;
-  captured_frame_.width        = width;
-  captured_frame_.height       = height;
-
-  //	captured_frame_.data_size =
-  // static_cast<uint32>(cricket::VideoFrame::SizeOf(width, height));
-  captured_frame_.data = new char[captured_frame_.data_size];
-  SPDLOG_TRACE(console, "ffmpeg size: {}", captured_frame_.data_size)
-  SPDLOG_TRACE(console, "webrtc size: {}", cricket::VideoFrame::SizeOf(width, height))
-
-  // Enumerate the supported formats. We have only one supported format. We set
-  // the frame interval to kMinimumInterval here. In Start(), if the capture
-  // format's interval is greater than kMinimumInterval, we use the interval;
-  // otherwise, we use the timestamp in the file to control the interval.
-  // TODO change supper fps to that from stream
-  cricket::VideoFormat     format(width, height, cricket::VideoFormat::FpsToInterval(fps), cricket::FOURCC_I420);
+  int    width;
+  int    height;
+  int    fps;
+  uint32 buf_size;
+
+  if (rendition_) {
+    gang_->GetVideoInfo(&width, &height, &fps, &buf_size);
+    gang_->GetRenditionInfo(rendition_, &width, &height, &buf_size);
+  } else {
+    gang_->GetSourceVideoInfo(&width, &height, &fps);
+  }
+
+  if (gang_->IsKeyFrameOnly()) fps = kKeyOnlyFps;
+  source_interval_ = cricket::VideoFormat::FpsToInterval(fps);
+  drop_interval_   = source_interval_ * 2 / 3;
+
+  // Enumerate the supported formats. A rendition has its own fixed size,
+  // otherwise offer a ladder of sizes below the source, each at the source
+  // rate and at kLowFps. Start has the decoder produce the chosen one.
   std::vector<VideoFormat> supported;
-  supported.push_back(format);
+  std::vector<int>         rates(1, fps);
+
+  if (!rendition_ && (fps > kLowFps)) rates.push_back(kLowFps);
+
+  for (int rate : rates) {
+    int64 interval = cricket::VideoFormat::FpsToInterval(rate);
+
+    supported.push_back(VideoFormat(width, height, interval, cricket::FOURCC_I420));
+
+    for (size_t i = 0; !rendition_ && height && i < sizeof(kLadderHeights) / sizeof(kLadderHeights[0]); i++) {
+      if (kLadderHeights[i] >= height) continue;
+
+      int w = static_cast<int>(static_cast<int64>(width) * kLadderHeights[i] / height) & ~1;
+      supported.push_back(VideoFormat(w, kLadderHeights[i], interval, cricket::FOURCC_I420));
+    }
+  }
   SetSupportedFormats(supported);
   SetApplyRotation(false);
 
@@ -141,9 +176,23 @@ CaptureState GangVideoCapturer::Start(const VideoFormat& capture_format) {
   CHECK(!running_);
   SetCaptureFormat(&capture_format);
 
+  if (!rendition_) {
+    int fps = cricket::VideoFormat::IntervalToFps(capture_format.interval);
+
+    gang_->SetVideoFormat(capture_format.width, capture_format.height, fps);
+
+    // The decoder may already run faster for other observers.
+    drop_interval_ = capture_format.interval * 2 / 3;
+  }
+
   accept_  = true;
   running_ = true;
-  gang_->StartVideoCapture(this, static_cast<uint8_t *>(captured_frame_.data));
+  gang_->StartVideoCapture(this, NULL, 0, rendition_);
+
+  // Below the source rate, let the decoder skip what would be dropped.
+  if (!rendition_ && (capture_format.interval > source_interval_)) {
+    gang_->SetVideoFrameRate(this, cricket::VideoFormat::IntervalToFps(capture_format.interval));
+  }
   SPDLOG_TRACE(console, "{}: {}", __func__, "sent")
   current_state_ = cricket::CS_STARTING;
   return current_state_;
@@ -196,30 +245,70 @@ void GangVideoCapturer::OnVideoStopped() {
 void GangVideoCapturer::onVideoStopped_s() {
   CHECK(thread_checker_.CalledOnValidThread());
   running_ = false;
+  AVFrame *pending = pending_frame_.exchange(NULL);
+  av_frame_free(&pending);
   SetCaptureFormat(NULL);
   onVideoStarted_s(cricket::CS_STOPPED);
   crit_.Leave();
   SPDLOG_TRACE(console, "{} indeed stopped", __func__)
 }
 
-void GangVideoCapturer::OnGangFrame() {
-  start_thread_->Invoke<void>(Bind(&GangVideoCapturer::onGangFrame_s, this));
+// Drop by interval before taking any ref, then latest frame wins the slot.
+void GangVideoCapturer::OnGangVideoFrame(const AVFrame *frame) {
+  if (!accept_) {
+    return;
+  }
+  int64 n = static_cast<int64>(rtc::TimeNanos());
+
+  if (n - last_frame_ns_ < drop_interval_) {
+    return;
+  }
+  AVFrame *ref = av_frame_clone(frame);
+
+  if (!ref) {
+    return;
+  }
+  last_frame_ns_ = n;
+
+  AVFrame *replaced = pending_frame_.exchange(ref);
+
+  if (replaced) {
+    // The owner thread has not taken it, so its message is still queued.
+    av_frame_free(&replaced);
+    return;
+  }
+  start_thread_->Post(start_thread_handler_, VIDEO_FRAME);
 }
 
+// Wrap the decoded planes without copying, webrtc holds a ref of the
+// AVFrame until it is done with the buffer.
 void GangVideoCapturer::onGangFrame_s() {
   CHECK(thread_checker_.CalledOnValidThread());
+  AVFrame *ref = pending_frame_.exchange(NULL);
 
-  if (!accept_) {
+  if (!ref) {
     return;
   }
-  int64 n = static_cast<int64>(rtc::TimeNanos());
 
-  if (n - captured_frame_.time_stamp < drop_interval_) {
+  if (!accept_) {
+    av_frame_free(&ref);
     return;
   }
-  captured_frame_.time_stamp   = n;
-  captured_frame_.elapsed_time = captured_frame_.time_stamp - start_time_ns_;
+  int64 n = static_cast<int64>(rtc::TimeNanos());
 
-  SignalFrameCaptured(this, &captured_frame_);
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer(
+    new rtc::RefCountedObject<webrtc::WrappedI420Buffer>(
+      ref->width,
+      ref->height,
+      ref->data[0],
+      ref->linesize[0],
+      ref->data[1],
+      ref->linesize[1],
+      ref->data[2],
+      ref->linesize[2],
+      rtc::Bind(&ReleaseFrame, ref)));
+  cricket::WebRtcVideoFrame video_frame(buffer, n - start_time_ns_, n, webrtc::kVideoRotation_0);
+
+  SignalVideoFrame(this, &video_frame);
 }
 } // namespace gang
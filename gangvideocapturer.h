@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include "webrtc/base/thread_checker.h"
 #include "talk/media/base/videocapturer.h"
@@ -9,18 +10,20 @@ using std::shared_ptr;
 using cricket::VideoCapturer;
 using cricket::VideoFormat;
 using cricket::CaptureState;
-using cricket::CapturedFrame;
 
 namespace gang {
+// rendition 0 captures the main output, others one added by AddRendition.
 VideoCapturer* CreateVideoCapturer(shared_ptr<GangDecoder> gang,
-                                   rtc::Thread            *thread);
+                                   rtc::Thread            *thread,
+                                   int                     rendition = 0);
 
 // Onwer signaling thread
 // Simulated video capturer that reads frames from a url.
 class GangVideoCapturer : public VideoCapturer, public GangFrameObserver {
 public:
   explicit GangVideoCapturer(shared_ptr<GangDecoder> gang,
-                             rtc::Thread            *thread);
+                             rtc::Thread            *thread,
+                             int                     rendition = 0);
   virtual ~GangVideoCapturer();
 
   void         Initialize();
@@ -37,8 +40,11 @@ public:
 
   // Called from gang when a new frame has been captured.
   // Implements VideoFrameObserver
-  // data uint8*
-  void OnGangFrame() override;
+  // Frames are delivered by ref to OnGangVideoFrame, OnGangFrame is unused.
+  // Never blocks the gang thread: the frame is put into a single slot
+  // mailbox, replacing one the owner thread has not taken yet.
+  void OnGangFrame() override {}
+  void OnGangVideoFrame(const AVFrame *frame) override;
 
 protected:
   // Override virtual methods of parent class VideoCapturer.
@@ -55,12 +61,15 @@ private:
   rtc::Thread                 *start_thread_;
   ThreadHandler               *start_thread_handler_;
   shared_ptr<GangDecoder>      gang_;
+  const int                    rendition_;
   int64                        start_time_ns_; // Time when the capturer starts.
-  int64                        drop_interval_;
+  int64                        last_frame_ns_; // gang thread only
+  int64                        source_interval_;
+  std::atomic<int64>           drop_interval_; // read on the gang thread
+  std::atomic<AVFrame *>       pending_frame_;
   bool                         running_;
-  bool                         accept_;
+  std::atomic<bool>            accept_;
   cricket::CaptureState        current_state_;
-  CapturedFrame                captured_frame_;
   rtc::ThreadChecker           thread_checker_;
   mutable rtc::CriticalSection crit_;
 
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <libavutil/channel_layout.h>
+
+#include "../ffmpeg_audio_chunker.h"
+#include "gang_test.h"
+
+#define FRAME_SAMPLES 1024
+#define BLOCK_SAMPLES 480
+
+// What a decoder of sample_rate stereo S16 leaves in its context.
+static void make_input(AVCodecContext *in, int sample_rate) {
+	memset(in, 0, sizeof(*in));
+	in->codec_type     = AVMEDIA_TYPE_AUDIO;
+	in->sample_rate    = sample_rate;
+	in->channels       = 2;
+	in->channel_layout = AV_CH_LAYOUT_STEREO;
+	in->sample_fmt     = AV_SAMPLE_FMT_S16;
+}
+
+// Stereo ramp, both channels hold the sample number.
+static int put_frame(AudioChunker *c, AVFrame *frame, int sample_rate, int64_t *next, int outputs) {
+	int16_t *samples;
+	int      i;
+	int      ret;
+
+	av_frame_unref(frame);
+	frame->format         = AV_SAMPLE_FMT_S16;
+	frame->channel_layout = AV_CH_LAYOUT_STEREO;
+	frame->sample_rate    = sample_rate;
+	frame->nb_samples     = FRAME_SAMPLES;
+	frame->pts            = *next;
+
+	if ((ret = av_frame_get_buffer(frame, 0)) < 0) return ret;
+	samples = (int16_t *)frame->data[0];
+
+	for (i = 0; i < FRAME_SAMPLES; i++) {
+		samples[2 * i]     = (int16_t)(*next + i);
+		samples[2 * i + 1] = (int16_t)(*next + i);
+	}
+	*next += FRAME_SAMPLES;
+	return audio_chunker_put(c, frame, av_make_q(1, sample_rate), outputs);
+}
+
+// Same format in and out, every 10 ms block is the next piece of the ramp
+// and nothing is lost between frames.
+static void test_exact_blocks() {
+	AVCodecContext in;
+	AudioChunker   c;
+	AVFrame       *frame = av_frame_alloc();
+	int16_t        block[BLOCK_SAMPLES * 2];
+	int64_t        next  = 0;
+	int64_t        read  = 0;
+	int64_t        pts;
+	int            i;
+
+	make_input(&in, 48000);
+	EXPECT(audio_chunker_init(&c, &in, AV_CH_LAYOUT_STEREO, 48000, AV_SAMPLE_FMT_S16) == 0);
+
+	EXPECT(audio_chunker_read(&c, AUDIO_CHUNK_LIVE, (uint8_t *)block, BLOCK_SAMPLES, &pts) == AVERROR(EAGAIN));
+
+	while (next < 48000) {
+		EXPECT(put_frame(&c, frame, 48000, &next, 1 << AUDIO_CHUNK_LIVE) == 0);
+
+		while (audio_chunker_read(&c, AUDIO_CHUNK_LIVE, (uint8_t *)block, BLOCK_SAMPLES, &pts) == 0) {
+			EXPECT(pts == read);
+
+			for (i = 0; i < BLOCK_SAMPLES; i++) {
+				if ((block[2 * i] != (int16_t)(read + i)) || (block[2 * i + 1] != (int16_t)(read + i))) {
+					EXPECT(!"ramp broken");
+					break;
+				}
+			}
+			read += BLOCK_SAMPLES;
+		}
+		EXPECT(audio_chunker_size(&c, AUDIO_CHUNK_LIVE) < BLOCK_SAMPLES);
+		EXPECT(read + audio_chunker_size(&c, AUDIO_CHUNK_LIVE) == next);
+	}
+
+	// Only the outputs in the mask are filled.
+	EXPECT(audio_chunker_size(&c, AUDIO_CHUNK_REC) == 0);
+
+	audio_chunker_reset(&c, AUDIO_CHUNK_LIVE);
+	EXPECT(audio_chunker_size(&c, AUDIO_CHUNK_LIVE) == 0);
+	audio_chunker_free(&c);
+	av_frame_free(&frame);
+}
+
+// 44.1 kHz input still comes out in whole 480 sample blocks at 48 kHz.
+static void test_resampled_blocks() {
+	AVCodecContext in;
+	AudioChunker   c;
+	AVFrame       *frame  = av_frame_alloc();
+	int16_t        block[BLOCK_SAMPLES * 2];
+	int64_t        next   = 0;
+	int64_t        blocks = 0;
+	int64_t        first  = AV_NOPTS_VALUE;
+	int64_t        pts;
+
+	make_input(&in, 44100);
+	EXPECT(audio_chunker_init(&c, &in, AV_CH_LAYOUT_STEREO, 48000, AV_SAMPLE_FMT_S16) == 0);
+
+	while (next + FRAME_SAMPLES <= 44100) {
+		EXPECT(put_frame(&c, frame, 44100, &next, 1 << AUDIO_CHUNK_LIVE) == 0);
+
+		while (audio_chunker_read(&c, AUDIO_CHUNK_LIVE, (uint8_t *)block, BLOCK_SAMPLES, &pts) == 0) {
+			if (first == AV_NOPTS_VALUE) first = pts;
+			EXPECT(pts == first + blocks * BLOCK_SAMPLES);
+			blocks++;
+		}
+	}
+	EXPECT(first == 0);
+
+	// 44032 samples make 47926 at 48 kHz, less what the resampler holds.
+	EXPECT(blocks >= 97);
+	EXPECT(blocks <= 99);
+	audio_chunker_free(&c);
+	av_frame_free(&frame);
+}
+
+// Positive ppm stretches the live output only.
+static void test_compensation() {
+	AVCodecContext in;
+	AudioChunker   c;
+	AVFrame       *frame = av_frame_alloc();
+	int16_t        block[BLOCK_SAMPLES * 2];
+	int64_t        next  = 0;
+	int64_t        last  = -BLOCK_SAMPLES;
+	int64_t        pts;
+	int            live;
+	int            rec;
+
+	make_input(&in, 48000);
+	EXPECT(audio_chunker_init(&c, &in, AV_CH_LAYOUT_STEREO, 48000, AV_SAMPLE_FMT_S16) == 0);
+	EXPECT(audio_chunker_set_compensation(&c, 1000) == 0);
+
+	while (next < 4 * 48000) {
+		EXPECT(put_frame(&c, frame, 48000, &next, (1 << AUDIO_CHUNK_LIVE) | (1 << AUDIO_CHUNK_REC)) == 0);
+	}
+	live = audio_chunker_size(&c, AUDIO_CHUNK_LIVE);
+	rec  = audio_chunker_size(&c, AUDIO_CHUNK_REC);
+	EXPECT(rec == next);
+	EXPECT(live > rec);
+	EXPECT(live < rec + 2 * 4 * 48);
+
+	// The live pts keeps source time, the extra 192 samples do not run it
+	// ahead of the input. The resampler holds a few back.
+	while (audio_chunker_read(&c, AUDIO_CHUNK_LIVE, (uint8_t *)block, BLOCK_SAMPLES, &pts) == 0) {
+		EXPECT(pts > last);
+		last = pts;
+	}
+	EXPECT(llabs(last + BLOCK_SAMPLES + audio_chunker_size(&c, AUDIO_CHUNK_LIVE) - next) <= 64);
+	audio_chunker_free(&c);
+	av_frame_free(&frame);
+}
+
+int main() {
+	test_exact_blocks();
+	test_resampled_blocks();
+	test_compensation();
+
+	return test_result();
+}
@@ -0,0 +1,116 @@
+#include <math.h>
+#include <stdio.h>
+
+#include "../ffmpeg_audio_level.h"
+#include "gang_test.h"
+
+#define N 4800
+
+static int16_t samples[N];
+
+static void fill_square(int amplitude) {
+	int i;
+
+	for (i = 0; i < N; i++) samples[i] = (i / 24) % 2 ? amplitude : -amplitude;
+}
+
+static void fill_sine(double amplitude) {
+	int i;
+
+	for (i = 0; i < N; i++) samples[i] = (int16_t)lround(amplitude * sin(2 * M_PI * i / 48.0));
+}
+
+static void measure(AudioLevel *l, int n) {
+	audio_level_reset(l);
+	audio_level_add(l, samples, n);
+}
+
+static void test_silence() {
+	AudioLevel l;
+	int        i;
+
+	for (i = 0; i < N; i++) samples[i] = 0;
+	measure(&l, N);
+	EXPECT(audio_level_rms_dbfs(&l) == AUDIO_LEVEL_FLOOR_DBFS);
+	EXPECT(audio_level_peak_dbfs(&l) == AUDIO_LEVEL_FLOOR_DBFS);
+
+	// Nothing measured yet is silence too.
+	audio_level_reset(&l);
+	EXPECT(audio_level_rms_dbfs(&l) == AUDIO_LEVEL_FLOOR_DBFS);
+}
+
+static void test_full_scale() {
+	AudioLevel l;
+
+	fill_square(32767);
+	measure(&l, N);
+	EXPECT(audio_level_rms_dbfs(&l) == 0);
+	EXPECT(audio_level_peak_dbfs(&l) == 0);
+
+	// The most negative sample is a full scale peak as well.
+	fill_square(32767);
+	samples[N / 2] = -32768;
+	measure(&l, N);
+	EXPECT(audio_level_peak_dbfs(&l) == 0);
+}
+
+static void test_sine_and_half_scale() {
+	AudioLevel l;
+
+	// RMS of a sine is 3dB under its peak.
+	fill_sine(32767);
+	measure(&l, N);
+	EXPECT(audio_level_rms_dbfs(&l) == -3);
+	EXPECT(audio_level_peak_dbfs(&l) == 0);
+
+	fill_square(16384);
+	measure(&l, N);
+	EXPECT(audio_level_rms_dbfs(&l) == -6);
+	EXPECT(audio_level_peak_dbfs(&l) == -6);
+
+	fill_sine(32767 / 100.0);
+	measure(&l, N);
+	EXPECT(audio_level_rms_dbfs(&l) == -43);
+	EXPECT(audio_level_peak_dbfs(&l) == -40);
+}
+
+// Sums add up over calls of any length, vector tails included.
+static void test_split_calls() {
+	AudioLevel whole, split;
+	int        i, n;
+
+	fill_sine(20000);
+	samples[1001] = -31000;
+	measure(&whole, N);
+	audio_level_reset(&split);
+
+	for (i = 0; i < N; i += n) {
+		n = 1 + (i * 7) % 13;
+
+		if (i + n > N) n = N - i;
+		audio_level_add(&split, samples + i, n);
+	}
+	EXPECT(split.sum_squares == whole.sum_squares);
+	EXPECT(split.samples == whole.samples);
+	EXPECT(split.peak == whole.peak);
+	EXPECT(whole.peak == 31000);
+}
+
+static void test_below() {
+	AudioLevel l;
+
+	fill_sine(32767 / 1000.0);
+	measure(&l, N);
+	EXPECT(audio_level_below(&l, -60));
+	EXPECT(!audio_level_below(&l, -70));
+}
+
+int main() {
+	test_silence();
+	test_full_scale();
+	test_sine_and_half_scale();
+	test_split_calls();
+	test_below();
+
+	return test_result();
+}
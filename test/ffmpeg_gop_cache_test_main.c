@@ -0,0 +1,98 @@
+#include <stdio.h>
+
+#include "../ffmpeg_gop_cache.h"
+#include "gang_test.h"
+
+// The cache takes its own refs, put unrefs the packet afterwards.
+static void put(GopCache *c, int64_t pts, int stream_index, int key) {
+	AVPacket pkt;
+
+	av_new_packet(&pkt, 1);
+	pkt.pts          = pts;
+	pkt.stream_index = stream_index;
+	pkt.flags        = key ? AV_PKT_FLAG_KEY : 0;
+	EXPECT(gop_cache_put(c, &pkt) == 0);
+	av_packet_unref(&pkt);
+}
+
+static void test_reset_on_key() {
+	GopCache c;
+
+	EXPECT(gop_cache_init(&c, 100, 0) == 0);
+
+	// Nothing to replay before the first keyframe.
+	put(&c, 0, 0, 0);
+	put(&c, 1, 1, 1);
+	EXPECT(!c.valid);
+	EXPECT(c.size == 0);
+
+	put(&c, 2, 0, 1);
+	put(&c, 3, 1, 0);
+	put(&c, 4, 0, 0);
+	EXPECT(c.valid);
+	EXPECT(c.size == 3);
+	EXPECT(c.pkts[0].pts == 2);
+	EXPECT(c.pkts[1].stream_index == 1);
+
+	// A keyframe of another stream does not start a GOP.
+	put(&c, 5, 1, 1);
+	EXPECT(c.size == 4);
+
+	put(&c, 6, 0, 1);
+	EXPECT(c.size == 1);
+	EXPECT(c.pkts[0].pts == 6);
+	EXPECT(c.pkts[0].flags & AV_PKT_FLAG_KEY);
+
+	gop_cache_reset(&c);
+	EXPECT(!c.valid);
+	EXPECT(c.size == 0);
+	gop_cache_free(&c);
+}
+
+// A GOP longer than max_pkts is dropped whole until the next keyframe.
+static void test_max_pkts_overflow() {
+	GopCache c;
+	int      i;
+
+	EXPECT(gop_cache_init(&c, 70, 0) == 0);
+	put(&c, 0, 0, 1);
+
+	for (i = 1; i < 70; i++) put(&c, i, 0, 0);
+	EXPECT(c.size == 70);
+	EXPECT(c.capacity == 70);
+
+	put(&c, 70, 0, 0);
+	EXPECT(!c.valid);
+	EXPECT(c.size == 0);
+
+	put(&c, 71, 0, 0);
+	EXPECT(c.size == 0);
+
+	put(&c, 72, 0, 1);
+	EXPECT(c.valid);
+	EXPECT(c.size == 1);
+	EXPECT(c.pkts[0].pts == 72);
+	gop_cache_free(&c);
+}
+
+static void test_disabled() {
+	GopCache c;
+
+	EXPECT(gop_cache_init(&c, 100, -1) == 0);
+	put(&c, 0, 0, 1);
+	EXPECT(c.size == 0);
+	gop_cache_free(&c);
+
+	EXPECT(gop_cache_init(&c, 0, 0) == 0);
+	put(&c, 0, 0, 1);
+	EXPECT(c.size == 0);
+	gop_cache_free(&c);
+}
+
+int main() {
+	test_reset_on_key();
+	test_max_pkts_overflow();
+	test_disabled();
+
+	return test_result();
+}
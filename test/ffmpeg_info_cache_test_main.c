@@ -0,0 +1,187 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libavutil/channel_layout.h>
+
+#include "../ffmpeg_info_cache.h"
+#include "gang_test.h"
+
+static const uint8_t extradata[] = {0x01, 0x64, 0x00, 0x1f, 0xff, 0xe1, 0x00, 0x19, 0x67};
+
+// Streams as avformat_open_input leaves them, probed ones get parameters.
+static AVFormatContext* make_input(int probed) {
+	AVFormatContext *ic = avformat_alloc_context();
+	AVCodecContext  *c;
+
+	c             = avformat_new_stream(ic, NULL)->codec;
+	c->codec_type = AVMEDIA_TYPE_VIDEO;
+	c->codec_id   = AV_CODEC_ID_H264;
+
+	if (probed) {
+		c->width                     = 1280;
+		c->height                    = 720;
+		c->pix_fmt                   = AV_PIX_FMT_YUV420P;
+		c->extradata                 = av_mallocz(sizeof(extradata) + AV_INPUT_BUFFER_PADDING_SIZE);
+		c->extradata_size            = sizeof(extradata);
+		ic->streams[0]->r_frame_rate = av_make_q(25, 1);
+		memcpy(c->extradata, extradata, sizeof(extradata));
+	}
+
+	c             = avformat_new_stream(ic, NULL)->codec;
+	c->codec_type = AVMEDIA_TYPE_AUDIO;
+	c->codec_id   = AV_CODEC_ID_AAC;
+
+	if (probed) {
+		c->sample_rate    = 44100;
+		c->channels       = 2;
+		c->sample_fmt     = AV_SAMPLE_FMT_S16;
+		c->channel_layout = AV_CH_LAYOUT_STEREO;
+	}
+	return ic;
+}
+
+static void test_round_trip(const char *url) {
+	AVFormatContext *probed = make_input(1);
+	AVFormatContext *ic     = make_input(0);
+	StreamInfoCache  cache;
+	AVCodecContext  *c;
+
+	info_cache_save(url, probed);
+	EXPECT(info_cache_load(url, &cache) == 1);
+	EXPECT(cache.nb_streams == 2);
+	EXPECT(info_cache_match(&cache, probed) == 1);
+
+	EXPECT(info_cache_apply(&cache, ic) == 1);
+	c = ic->streams[0]->codec;
+	EXPECT(c->width == 1280);
+	EXPECT(c->height == 720);
+	EXPECT(c->pix_fmt == AV_PIX_FMT_YUV420P);
+	EXPECT(ic->streams[0]->r_frame_rate.num == 25);
+	EXPECT(ic->streams[0]->r_frame_rate.den == 1);
+	EXPECT(c->extradata_size == sizeof(extradata));
+	EXPECT(c->extradata && !memcmp(c->extradata, extradata, sizeof(extradata)));
+
+	c = ic->streams[1]->codec;
+	EXPECT(c->sample_rate == 44100);
+	EXPECT(c->channels == 2);
+	EXPECT(c->sample_fmt == AV_SAMPLE_FMT_S16);
+	EXPECT(c->channel_layout == AV_CH_LAYOUT_STEREO);
+	EXPECT(!c->extradata_size);
+	info_cache_free(&cache);
+
+	// Another url has no entry.
+	EXPECT(info_cache_load("rtsp://127.0.0.1/other", &cache) == 0);
+	avformat_free_context(ic);
+	avformat_free_context(probed);
+}
+
+// What open_input does when the stream changed behind the cache: the
+// short probe no longer matches, the entry goes and the full probe runs.
+static void test_stale_entry(const char *url) {
+	AVFormatContext *probed = make_input(1);
+	AVFormatContext *ic     = make_input(0);
+	StreamInfoCache  cache;
+
+	info_cache_save(url, probed);
+	probed->streams[0]->codec->width = 1920;
+
+	EXPECT(info_cache_load(url, &cache) == 1);
+	EXPECT(info_cache_match(&cache, probed) == 0);
+	info_cache_free(&cache);
+	info_cache_remove(url);
+	EXPECT(info_cache_load(url, &cache) == 0);
+
+	info_cache_save(url, probed);
+	EXPECT(info_cache_load(url, &cache) == 1);
+	EXPECT(info_cache_match(&cache, probed) == 1);
+	info_cache_free(&cache);
+
+	// Different codecs are not applied at all.
+	ic->streams[1]->codec->codec_id = AV_CODEC_ID_OPUS;
+	EXPECT(info_cache_load(url, &cache) == 1);
+	EXPECT(info_cache_apply(&cache, ic) == 0);
+	info_cache_free(&cache);
+	avformat_free_context(ic);
+	avformat_free_context(probed);
+}
+
+// Entry files of dir cut to half their length.
+static void truncate_entries(const char *dir) {
+	DIR           *d = opendir(dir);
+	struct dirent *e;
+	char           path[1024];
+	FILE          *f;
+	long           size;
+
+	while (d && (e = readdir(d))) {
+		if (e->d_name[0] == '.') continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+		f    = fopen(path, "r");
+		fseek(f, 0, SEEK_END);
+		size = ftell(f);
+		fclose(f);
+		EXPECT(truncate(path, size / 2) == 0);
+	}
+
+	if (d) closedir(d);
+}
+
+static void remove_entries(const char *dir) {
+	DIR           *d = opendir(dir);
+	struct dirent *e;
+	char           path[1024];
+
+	while (d && (e = readdir(d))) {
+		if (e->d_name[0] == '.') continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+		remove(path);
+	}
+
+	if (d) closedir(d);
+}
+
+static void test_broken_entry(const char *dir, const char *url) {
+	AVFormatContext *probed = make_input(1);
+	StreamInfoCache  cache;
+
+	info_cache_save(url, probed);
+	truncate_entries(dir);
+	EXPECT(info_cache_load(url, &cache) == 0);
+	EXPECT(cache.nb_streams == 0);
+	avformat_free_context(probed);
+}
+
+static void test_disabled(const char *url) {
+	AVFormatContext *probed = make_input(1);
+	StreamInfoCache  cache;
+
+	set_stream_info_cache_dir(NULL);
+	EXPECT(get_stream_info_cache_dir() == NULL);
+	info_cache_save(url, probed);
+	EXPECT(info_cache_load(url, &cache) == 0);
+	avformat_free_context(probed);
+}
+
+int main() {
+	const char *url = "rtsp://127.0.0.1:8554/test";
+	char        dir[] = "/tmp/gang_info_cache_XXXXXX";
+
+	if (!mkdtemp(dir)) {
+		printf("Could not create %s\n", dir);
+		return 1;
+	}
+	set_stream_info_cache_dir(dir);
+
+	test_round_trip(url);
+	remove_entries(dir);
+	test_stale_entry(url);
+	remove_entries(dir);
+	test_broken_entry(dir, url);
+	remove_entries(dir);
+	test_disabled(url);
+	rmdir(dir);
+
+	return test_result();
+}
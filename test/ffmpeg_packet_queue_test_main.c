@@ -0,0 +1,181 @@
+#include <pthread.h>
+#include <stdio.h>
+
+#include "../ffmpeg_packet_queue.h"
+#include "gang_test.h"
+
+// The payload carries seq so the consumer can check the order.
+static void make_packet(AVPacket *pkt, int seq, int stream_index, int key) {
+	av_new_packet(pkt, 4);
+	pkt->data[0]      = seq;
+	pkt->data[1]      = seq >> 8;
+	pkt->data[2]      = seq >> 16;
+	pkt->pts          = seq;
+	pkt->stream_index = stream_index;
+	pkt->flags        = key ? AV_PKT_FLAG_KEY : 0;
+}
+
+static int packet_seq(const AVPacket *pkt) {
+	return pkt->data[0] | (pkt->data[1] << 8) | (pkt->data[2] << 16);
+}
+
+#define STREAM_PKTS 10000
+
+static void *produce(void *opaque) {
+	PacketQueue *q = opaque;
+	AVPacket     pkt;
+	int          i;
+
+	for (i = 0; i < STREAM_PKTS; i++) {
+		make_packet(&pkt, i, 0, 0);
+
+		if (packet_queue_put(q, &pkt)) break;
+	}
+	packet_queue_set_eof(q, AVERROR_EOF);
+	return NULL;
+}
+
+// A small ring wraps many times, the producer blocks instead of dropping.
+static void test_block_wraparound() {
+	PacketQueue q;
+	pthread_t   producer;
+	AVPacket    pkt;
+	int         next = 0;
+	int         ret;
+
+	EXPECT(packet_queue_init(&q, 4, PKT_QUEUE_BLOCK, 0) == 0);
+	pthread_create(&producer, NULL, produce, &q);
+
+	while ((ret = packet_queue_get(&q, &pkt, 1000)) != AVERROR_EOF) {
+		if (ret == AVERROR(EAGAIN)) continue;
+		EXPECT(ret == 0);
+		EXPECT(packet_seq(&pkt) == next);
+		EXPECT(packet_queue_occupancy(&q) <= 4);
+		next++;
+		av_packet_unref(&pkt);
+	}
+	pthread_join(producer, NULL);
+
+	EXPECT(next == STREAM_PKTS);
+	EXPECT(packet_queue_dropped(&q) == 0);
+	packet_queue_destroy(&q);
+}
+
+// A full queue drops key_stream until its next keyframe, other streams
+// only while full.
+static void test_drop_until_key() {
+	PacketQueue q;
+	AVPacket    pkt;
+	int         i;
+
+	EXPECT(packet_queue_init(&q, 4, PKT_QUEUE_DROP, 0) == 0);
+
+	for (i = 0; i < 4; i++) {
+		make_packet(&pkt, i, 0, i == 0);
+		EXPECT(packet_queue_put(&q, &pkt) == 0);
+	}
+	make_packet(&pkt, 4, 0, 0);
+	EXPECT(packet_queue_put(&q, &pkt) == 1);
+	EXPECT(packet_queue_occupancy(&q) == 4);
+
+	// Room again, but the video GOP is broken.
+	for (i = 0; i < 4; i++) {
+		EXPECT(packet_queue_get(&q, &pkt, 0) == 0);
+		EXPECT(packet_seq(&pkt) == i);
+		av_packet_unref(&pkt);
+	}
+	make_packet(&pkt, 5, 0, 0);
+	EXPECT(packet_queue_put(&q, &pkt) == 1);
+	make_packet(&pkt, 6, 1, 0);
+	EXPECT(packet_queue_put(&q, &pkt) == 0);
+	make_packet(&pkt, 7, 0, 1);
+	EXPECT(packet_queue_put(&q, &pkt) == 0);
+	make_packet(&pkt, 8, 0, 0);
+	EXPECT(packet_queue_put(&q, &pkt) == 0);
+	EXPECT(packet_queue_dropped(&q) == 2);
+
+	for (i = 6; i <= 8; i++) {
+		EXPECT(packet_queue_get(&q, &pkt, 0) == 0);
+		EXPECT(packet_seq(&pkt) == i);
+		av_packet_unref(&pkt);
+	}
+	EXPECT(packet_queue_get(&q, &pkt, 0) == AVERROR(EAGAIN));
+
+	// An audio packet over the top is lost alone, video goes on.
+	for (i = 9; i < 13; i++) {
+		make_packet(&pkt, i, 0, 0);
+		EXPECT(packet_queue_put(&q, &pkt) == 0);
+	}
+	make_packet(&pkt, 13, 1, 0);
+	EXPECT(packet_queue_put(&q, &pkt) == 1);
+	EXPECT(packet_queue_dropped(&q) == 3);
+
+	for (i = 9; i < 13; i++) {
+		EXPECT(packet_queue_get(&q, &pkt, 0) == 0);
+		av_packet_unref(&pkt);
+	}
+	make_packet(&pkt, 14, 0, 0);
+	EXPECT(packet_queue_put(&q, &pkt) == 0);
+	EXPECT((packet_queue_get(&q, &pkt, 0) == 0) && (packet_seq(&pkt) == 14));
+	av_packet_unref(&pkt);
+	packet_queue_destroy(&q);
+}
+
+// Packets put before eof come first, then eof on every call.
+static void test_eof_after_packets() {
+	PacketQueue q;
+	AVPacket    pkt;
+
+	EXPECT(packet_queue_init(&q, 4, PKT_QUEUE_BLOCK, -1) == 0);
+	make_packet(&pkt, 1, 0, 1);
+	packet_queue_put(&q, &pkt);
+	packet_queue_set_eof(&q, AVERROR(EIO));
+
+	EXPECT(packet_queue_get(&q, &pkt, 10) == 0);
+	EXPECT(packet_seq(&pkt) == 1);
+	av_packet_unref(&pkt);
+	EXPECT(packet_queue_get(&q, &pkt, 10) == AVERROR(EIO));
+	EXPECT(packet_queue_get(&q, &pkt, 10) == AVERROR(EIO));
+	packet_queue_destroy(&q);
+}
+
+static void count_notify(void *opaque) {
+	(*(int *)opaque)++;
+}
+
+// notify comes once per arm, and not at all when a packet already waits.
+static void test_arm() {
+	PacketQueue q;
+	AVPacket    pkt;
+	int         notified = 0;
+
+	EXPECT(packet_queue_init(&q, 4, PKT_QUEUE_BLOCK, -1) == 0);
+	EXPECT(packet_queue_arm(&q, count_notify, &notified) == 1);
+
+	make_packet(&pkt, 1, 0, 1);
+	packet_queue_put(&q, &pkt);
+	make_packet(&pkt, 2, 0, 0);
+	packet_queue_put(&q, &pkt);
+	EXPECT(notified == 1);
+
+	EXPECT(packet_queue_arm(&q, count_notify, &notified) == 0);
+	make_packet(&pkt, 3, 0, 0);
+	packet_queue_put(&q, &pkt);
+	EXPECT(notified == 1);
+
+	while (packet_queue_get(&q, &pkt, 0) == 0) av_packet_unref(&pkt);
+	EXPECT(packet_queue_arm(&q, count_notify, &notified) == 1);
+	packet_queue_set_eof(&q, AVERROR_EOF);
+	EXPECT(notified == 2);
+	EXPECT(packet_queue_arm(&q, count_notify, &notified) == 0);
+	packet_queue_destroy(&q);
+}
+
+int main() {
+	test_block_wraparound();
+	test_drop_until_key();
+	test_eof_after_packets();
+	test_arm();
+
+	return test_result();
+}
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../gang_audio_drift.h"
+#include "gang_test.h"
+
+using namespace gang;
+
+static const int kTargetMs = 60;
+
+// 10ms blocks of a source whose clock runs ppm fast, each delayed by up to
+// jitter_us on the way, for seconds of local time.
+static void feed(AudioDriftEstimator *e, int ppm, int jitter_us, int seconds, int buffered_ms) {
+	for (int64_t k = 0; k < seconds * 100; k++) {
+		int64_t src_us = k * 10000;
+		int64_t now_us = src_us * 1000000 / (1000000 + ppm) + (jitter_us ? rand() % jitter_us : 0);
+
+		e->Update(src_us, now_us, buffered_ms);
+	}
+}
+
+static void test_sign_and_convergence(int ppm) {
+	AudioDriftEstimator e(kTargetMs);
+
+	srand(1);
+
+	// Nothing is known before two windows.
+	feed(&e, ppm, 20000, 5, kTargetMs);
+	EXPECT(e.DriftPpm() == 0);
+
+	AudioDriftEstimator c(kTargetMs);
+
+	feed(&c, ppm, 20000, 120, kTargetMs);
+	EXPECT(abs(c.DriftPpm() - ppm) <= 10);
+
+	// A fast source is resampled to fewer samples and the other way round.
+	EXPECT(abs(c.CompensationPpm() + ppm) <= 20);
+}
+
+static void test_level() {
+	AudioDriftEstimator e(kTargetMs);
+
+	// Too much buffered, play it out faster: fewer samples.
+	feed(&e, 0, 0, 20, kTargetMs + 20);
+	EXPECT(e.DriftPpm() == 0);
+	EXPECT(e.CompensationPpm() < 0);
+
+	AudioDriftEstimator f(kTargetMs);
+
+	feed(&f, 0, 0, 20, kTargetMs - 20);
+	EXPECT(f.CompensationPpm() > 0);
+
+	// Held within a pitch change nobody hears.
+	AudioDriftEstimator g(kTargetMs);
+
+	feed(&g, 0, 0, 20, kTargetMs + 10000);
+	EXPECT(g.CompensationPpm() == -2000);
+}
+
+// A stall is not taken for drift, the estimate stays near and converges
+// back.
+static void test_stall() {
+	AudioDriftEstimator e(kTargetMs);
+
+	feed(&e, 100, 0, 60, kTargetMs);
+	EXPECT(abs(e.DriftPpm() - 100) <= 2);
+
+	for (int64_t k = 6000; k < 18000; k++) {
+		int64_t src_us = k * 10000;
+		int64_t now_us = src_us * 1000000 / (1000000 + 100) + (k > 7500 ? 500000 : 0);
+
+		e.Update(src_us, now_us, kTargetMs);
+		EXPECT(abs(e.DriftPpm() - 100) <= 50);
+	}
+	EXPECT(abs(e.DriftPpm() - 100) <= 2);
+}
+
+int main() {
+	test_sign_and_convergence(200);
+	test_sign_and_convergence(-200);
+	test_sign_and_convergence(50);
+	test_level();
+	test_stall();
+
+	return test_result();
+}
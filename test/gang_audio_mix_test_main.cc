@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../gang_audio_mix.h"
+#include "gang_test.h"
+
+using namespace gang;
+
+static int16_t saturate(int32_t v) {
+	return v > INT16_MAX ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : (int16_t)v);
+}
+
+// The plain C definition the SIMD paths must match sample for sample.
+static void mix_scalar(int16_t *dst, const int16_t *src, size_t n, int gain) {
+	for (size_t i = 0; i < n; i++) {
+		dst[i] = saturate(dst[i] + saturate((src[i] * gain) >> kGainBits));
+	}
+}
+
+static int16_t random_sample() {
+	// Extremes often, so the saturating lanes are hit.
+	switch (rand() % 8) {
+	case 0: return INT16_MAX;
+	case 1: return INT16_MIN;
+	default: return (int16_t)(rand() % 65536 - 32768);
+	}
+}
+
+// Odd lengths run both the vector loop and the scalar tail.
+static void test_matches_scalar() {
+	const int gains[] = {0, 1, kUnityGain / 2, kUnityGain - 1, kUnityGain, kUnityGain + 1, kMaxGain};
+	int16_t   dst[67], src[67], ref[67];
+
+	for (size_t g = 0; g < sizeof(gains) / sizeof(gains[0]); g++) {
+		for (int round = 0; round < 200; round++) {
+			size_t n = rand() % 68;
+
+			for (size_t i = 0; i < n; i++) {
+				dst[i] = ref[i] = random_sample();
+				src[i] = random_sample();
+			}
+			mix_scalar(ref, src, n, gains[g]);
+			MixS16(dst, src, n, gains[g]);
+
+			for (size_t i = 0; i < n; i++) {
+				if (dst[i] != ref[i]) {
+					printf("gain %d, sample %zu: %d != %d\n", gains[g], i, dst[i], ref[i]);
+					failures++;
+					break;
+				}
+			}
+		}
+	}
+}
+
+static void test_saturation() {
+	int16_t dst[16], src[16];
+
+	for (int i = 0; i < 16; i++) {
+		dst[i] = 30000;
+		src[i] = 30000;
+	}
+	MixS16(dst, src, 16, kUnityGain);
+
+	for (int i = 0; i < 16; i++) EXPECT(dst[i] == INT16_MAX);
+
+	for (int i = 0; i < 16; i++) {
+		dst[i] = -30000;
+		src[i] = INT16_MIN;
+	}
+	MixS16(dst, src, 16, kMaxGain);
+
+	for (int i = 0; i < 16; i++) EXPECT(dst[i] == INT16_MIN);
+
+	// A gain near 2.0 saturates the scaled sample before the sum.
+	for (int i = 0; i < 16; i++) {
+		dst[i] = -1000;
+		src[i] = 30000;
+	}
+	MixS16(dst, src, 16, kMaxGain);
+
+	for (int i = 0; i < 16; i++) EXPECT(dst[i] == INT16_MAX - 1000);
+}
+
+static void test_gain_from_float() {
+	EXPECT(GainFromFloat(-1) == 0);
+	EXPECT(GainFromFloat(0) == 0);
+	EXPECT(GainFromFloat(1) == kUnityGain);
+	EXPECT(GainFromFloat(0.5f) == kUnityGain / 2);
+	EXPECT(GainFromFloat(4) == kMaxGain);
+}
+
+int main() {
+	srand(1);
+	test_matches_scalar();
+	test_saturation();
+	test_gain_from_float();
+
+	return test_result();
+}
@@ -0,0 +1,450 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+
+#include "../gang_decoder_impl.h"
+#include "gang_test.h"
+
+#define CLIP_WIDTH  320
+#define CLIP_HEIGHT 240
+#define CLIP_FPS    25
+#define CLIP_GOP    10
+#define CLIP_FRAMES 50
+#define CLIP_RATE   48000
+
+// 10ms blocks of the clip audio.
+#define CLIP_BLOCKS (CLIP_FRAMES * 100 / CLIP_FPS)
+
+// Bound on the steps of a decode, a hang fails instead.
+#define MAX_STEPS 100000
+
+static char clip[256];
+static int  clip_keys;
+
+static AVCodecContext* add_stream(AVFormatContext *o, enum AVCodecID id, AVStream **st) {
+	AVCodec        *codec = avcodec_find_encoder(id);
+	AVCodecContext *enc   = codec ? avcodec_alloc_context3(codec) : NULL;
+
+	if (!enc) return NULL;
+
+	if (codec->type == AVMEDIA_TYPE_VIDEO) {
+		enc->width        = CLIP_WIDTH;
+		enc->height       = CLIP_HEIGHT;
+		enc->pix_fmt      = AV_PIX_FMT_YUV420P;
+		enc->time_base    = av_make_q(1, CLIP_FPS);
+		enc->gop_size     = CLIP_GOP;
+		enc->max_b_frames = 0;
+	} else {
+		enc->sample_fmt     = AV_SAMPLE_FMT_S16;
+		enc->sample_rate    = CLIP_RATE;
+		enc->channel_layout = AV_CH_LAYOUT_STEREO;
+		enc->channels       = 2;
+		enc->time_base      = av_make_q(1, CLIP_RATE);
+	}
+
+	if (o->oformat->flags & AVFMT_GLOBALHEADER) enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+	*st = avformat_new_stream(o, NULL);
+
+	if (!*st || (avcodec_open2(enc, codec, NULL) < 0) ||
+	    (avcodec_parameters_from_context((*st)->codecpar, enc) < 0)) {
+		avcodec_free_context(&enc);
+		return NULL;
+	}
+	(*st)->time_base = enc->time_base;
+	return enc;
+}
+
+// Encode frame, NULL flushes, and write what comes out.
+static int encode(AVFormatContext *o, AVCodecContext *enc, AVStream *st, AVFrame *frame) {
+	AVPacket pkt;
+	int      ret = avcodec_send_frame(enc, frame);
+
+	while (ret >= 0) {
+		av_init_packet(&pkt);
+		pkt.data = NULL;
+		pkt.size = 0;
+
+		ret = avcodec_receive_packet(enc, &pkt);
+		if ((ret == AVERROR(EAGAIN)) || (ret == AVERROR_EOF)) return 0;
+		if (ret < 0) break;
+
+		if ((enc->codec_type == AVMEDIA_TYPE_VIDEO) && (pkt.flags & AV_PKT_FLAG_KEY)) clip_keys++;
+		av_packet_rescale_ts(&pkt, enc->time_base, st->time_base);
+		pkt.stream_index = st->index;
+		ret              = av_interleaved_write_frame(o, &pkt);
+	}
+	return ret;
+}
+
+// CLIP_FRAMES of a moving ramp with a keyframe every CLIP_GOP, and as
+// long a stereo ramp, in a file the decoder opens like any input.
+static int write_clip(void) {
+	AVFormatContext *o = NULL;
+	AVCodecContext  *v = NULL;
+	AVCodecContext  *a = NULL;
+	AVStream        *vs;
+	AVStream        *as;
+	AVFrame         *frame = av_frame_alloc();
+	int16_t         *samples;
+	int              i, x, y;
+	int              ret;
+
+	snprintf(clip, sizeof(clip), "%s/gang_decoder_test_%d.nut", getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", (int)getpid());
+
+	if ((ret = avformat_alloc_output_context2(&o, NULL, "nut", clip)) < 0) goto end;
+
+	v = add_stream(o, AV_CODEC_ID_MPEG4, &vs);
+	a = add_stream(o, AV_CODEC_ID_PCM_S16LE, &as);
+
+	if (!frame || !v || !a) {
+		ret = AVERROR(ENOMEM);
+		goto end;
+	}
+
+	if ((ret = avio_open(&o->pb, clip, AVIO_FLAG_WRITE)) < 0) goto end;
+	if ((ret = avformat_write_header(o, NULL)) < 0) goto end;
+
+	for (i = 0; i < CLIP_FRAMES; i++) {
+		av_frame_unref(frame);
+		frame->format    = AV_PIX_FMT_YUV420P;
+		frame->width     = CLIP_WIDTH;
+		frame->height    = CLIP_HEIGHT;
+		frame->pts       = i;
+		frame->pict_type = i % CLIP_GOP ? AV_PICTURE_TYPE_NONE : AV_PICTURE_TYPE_I;
+
+		if ((ret = av_frame_get_buffer(frame, 32)) < 0) goto end;
+
+		for (y = 0; y < CLIP_HEIGHT; y++) {
+			for (x = 0; x < CLIP_WIDTH; x++) frame->data[0][y * frame->linesize[0] + x] = (uint8_t)(x + y + 4 * i);
+		}
+
+		for (y = 0; y < CLIP_HEIGHT / 2; y++) {
+			memset(frame->data[1] + y * frame->linesize[1], 128, CLIP_WIDTH / 2);
+			memset(frame->data[2] + y * frame->linesize[2], 128, CLIP_WIDTH / 2);
+		}
+
+		if ((ret = encode(o, v, vs, frame)) < 0) goto end;
+
+		av_frame_unref(frame);
+		frame->format         = AV_SAMPLE_FMT_S16;
+		frame->channel_layout = AV_CH_LAYOUT_STEREO;
+		frame->sample_rate    = CLIP_RATE;
+		frame->nb_samples     = CLIP_RATE / CLIP_FPS;
+		frame->pts            = (int64_t)i * frame->nb_samples;
+
+		if ((ret = av_frame_get_buffer(frame, 0)) < 0) goto end;
+		samples = (int16_t *)frame->data[0];
+
+		for (x = 0; x < 2 * frame->nb_samples; x++) samples[x] = (int16_t)(x * 16);
+
+		if ((ret = encode(o, a, as, frame)) < 0) goto end;
+	}
+
+	if ((ret = encode(o, v, vs, NULL)) < 0) goto end;
+	if ((ret = encode(o, a, as, NULL)) < 0) goto end;
+
+	ret = av_write_trailer(o);
+
+end:
+	if (o && o->pb) avio_closep(&o->pb);
+	avformat_free_context(o);
+	avcodec_free_context(&v);
+	avcodec_free_context(&a);
+	av_frame_free(&frame);
+	return ret;
+}
+
+// What a decode delivered.
+typedef struct Run {
+	int     video;
+	int     keys;
+	int     last_key;   // the last video frame was a keyframe
+	int     width;
+	int     height;
+	int     backwards;  // video frames not after the one before
+	int64_t last_pts;
+	int     renditions; // rendition frames ready with a video frame
+	int     same_pts;   // of them, at the pts of the main frame
+	int     rendition_width;
+	int     audio;
+	int     steps;
+} Run;
+
+static gang_decoder* new_clip_decoder(void) {
+	return new_gang_decoder(clip, "", 0, 0);
+}
+
+// Open dec with video by ref and audio delivered, like GangDecoder with a
+// video and an audio observer.
+static int open_clip_decoder(gang_decoder *dec, int video, int audio) {
+	int ret = open_gang_decoder(dec);
+
+	if (ret < 0) return ret;
+
+	dec->video_by_ref = video;
+
+	if (audio) dec->audio_buff = av_malloc(dec->audio_buff_size);
+	return 0;
+}
+
+static void free_clip_decoder(gang_decoder *dec) {
+	av_freep(&dec->audio_buff);
+	close_gang_decoder(dec);
+	free_gang_decoder(dec);
+}
+
+// One step of dec, taking what it delivered like GangDecoder does.
+// return: as gang_decode_next_frame
+static int step(gang_decoder *dec, Run *r) {
+	AVFrame *frame;
+	int      ret = gang_decode_next_frame(dec);
+	int      i;
+
+	r->steps++;
+
+	if (ret == GANG_AUDIO_DATA) r->audio++;
+
+	if (ret != GANG_VIDEO_DATA) return ret;
+
+	frame = dec->video_frame;
+	r->video++;
+	r->width  = frame->width;
+	r->height = frame->height;
+
+	r->last_key = frame->key_frame;
+
+	if (frame->key_frame) r->keys++;
+	if ((r->video > 1) && (frame->pts <= r->last_pts)) r->backwards++;
+	r->last_pts = frame->pts;
+
+	for (i = 0; i < dec->nb_renditions; i++) {
+		if (!dec->renditions[i].ready) continue;
+
+		r->renditions++;
+		r->rendition_width = dec->renditions[i].frame->width;
+
+		if (dec->renditions[i].frame->pts == frame->pts) r->same_pts++;
+		av_frame_unref(dec->renditions[i].frame);
+		dec->renditions[i].ready = 0;
+	}
+	av_frame_unref(frame);
+	return ret;
+}
+
+// Decode to the end of the clip.
+static void run(gang_decoder *dec, Run *r) {
+	while ((step(dec, r) != GANG_FITAL) && (r->steps < MAX_STEPS)) {}
+	EXPECT(r->steps < MAX_STEPS);
+}
+
+// Every frame of the main output comes with the rendition frame of the
+// same time, also when a rate limit leaves several in the rendition sink.
+static void test_renditions() {
+	gang_decoder *dec = new_clip_decoder();
+	Run           r   = {0};
+
+	EXPECT(add_gang_decoder_rendition(dec, CLIP_WIDTH / 2, CLIP_HEIGHT / 2) == 1);
+	set_gang_decoder_video_format(dec, 0, 0, 5);
+	EXPECT(open_clip_decoder(dec, 1, 0) == 0);
+
+	run(dec, &r);
+	EXPECT(r.video > 0);
+	EXPECT(r.width == CLIP_WIDTH);
+	EXPECT(r.renditions == r.video);
+	EXPECT(r.same_pts == r.video);
+	EXPECT(r.rendition_width == CLIP_WIDTH / 2);
+	free_clip_decoder(dec);
+}
+
+// Scaled and rate limited in the graph, never scaled up.
+static void test_video_format() {
+	gang_decoder *dec = new_clip_decoder();
+	Run           r   = {0};
+	Run           up  = {0};
+
+	set_gang_decoder_video_format(dec, CLIP_WIDTH / 2, CLIP_HEIGHT / 2, 5);
+	EXPECT(open_clip_decoder(dec, 1, 0) == 0);
+	EXPECT(dec->width == CLIP_WIDTH / 2);
+	EXPECT(dec->fps == 5);
+
+	run(dec, &r);
+	EXPECT(r.width == CLIP_WIDTH / 2);
+	EXPECT(r.height == CLIP_HEIGHT / 2);
+	EXPECT(r.video >= CLIP_FRAMES * 5 / CLIP_FPS - 2);
+	EXPECT(r.video <= CLIP_FRAMES * 5 / CLIP_FPS + 1);
+	EXPECT(r.backwards == 0);
+	free_clip_decoder(dec);
+
+	dec = new_clip_decoder();
+	set_gang_decoder_video_format(dec, CLIP_WIDTH * 2, CLIP_HEIGHT * 2, 0);
+	EXPECT(open_clip_decoder(dec, 1, 0) == 0);
+
+	run(dec, &up);
+	EXPECT(up.width == CLIP_WIDTH);
+	EXPECT(up.video == CLIP_FRAMES);
+	free_clip_decoder(dec);
+}
+
+// Video nobody is due to take is dropped before filtering, the audio
+// goes on.
+static void test_skip() {
+	gang_decoder *dec = new_clip_decoder();
+	Run           r   = {0};
+
+	EXPECT(open_clip_decoder(dec, 1, 1) == 0);
+
+	do {
+		set_gang_decoder_video_demand(dec, GANG_DEMAND_ALL, 1);
+	} while ((step(dec, &r) != GANG_FITAL) && (r.steps < MAX_STEPS));
+
+	EXPECT(r.video == 0);
+	EXPECT(r.audio == CLIP_BLOCKS);
+	free_clip_decoder(dec);
+}
+
+// Only keyframes are decoded, and a rate limit does not repeat them over
+// the gaps between.
+static void test_key_only() {
+	gang_decoder *dec = new_clip_decoder();
+	Run           r   = {0};
+	Run           limited = {0};
+
+	set_gang_decoder_key_only(dec, 1);
+	EXPECT(open_clip_decoder(dec, 1, 0) == 0);
+
+	run(dec, &r);
+	EXPECT(r.video == clip_keys);
+	EXPECT(r.keys == clip_keys);
+	free_clip_decoder(dec);
+
+	dec = new_clip_decoder();
+	set_gang_decoder_key_only(dec, 1);
+	set_gang_decoder_video_format(dec, 0, 0, 5);
+	EXPECT(open_clip_decoder(dec, 1, 0) == 0);
+
+	run(dec, &limited);
+	EXPECT(limited.video == clip_keys);
+	EXPECT(limited.backwards == 0);
+	free_clip_decoder(dec);
+}
+
+// A stream without a consumer is left undecoded. Video left for a while
+// resumes at a keyframe, and the rate limit does not make up for the idle
+// time with repeats.
+static void test_selective() {
+	gang_decoder *dec     = new_clip_decoder();
+	Run           r       = {0};
+	Run           resumed = {0};
+	int           before  = 0;
+	int           ret;
+
+	EXPECT(open_clip_decoder(dec, 0, 1) == 0);
+
+	run(dec, &r);
+	EXPECT(r.video == 0);
+	EXPECT(r.audio == CLIP_BLOCKS);
+	free_clip_decoder(dec);
+
+	dec = new_clip_decoder();
+	set_gang_decoder_video_format(dec, 0, 0, 5);
+	set_gang_decoder_gop_cache(dec, 0);
+	EXPECT(open_clip_decoder(dec, 1, 1) == 0);
+
+	do {
+		// Video is taken for 0.4s, left for 0.8s and taken again.
+		dec->video_by_ref = (resumed.audio < CLIP_BLOCKS / 5) || (resumed.audio >= CLIP_BLOCKS * 3 / 5);
+
+		if (resumed.audio < CLIP_BLOCKS * 3 / 5) before = resumed.video;
+		ret = step(dec, &resumed);
+
+		if ((ret == GANG_VIDEO_DATA) && (resumed.video == before + 1) && (resumed.audio >= CLIP_BLOCKS * 3 / 5)) {
+			EXPECT(resumed.last_key);
+		}
+	} while ((ret != GANG_FITAL) && (resumed.steps < MAX_STEPS));
+
+	// 0.8s left at 5 fps.
+	EXPECT(resumed.video > before);
+	EXPECT(resumed.video - before <= 5);
+	EXPECT(resumed.backwards == 0);
+	EXPECT(resumed.audio == CLIP_BLOCKS);
+	free_clip_decoder(dec);
+}
+
+// Video taken again after a pause, as a lingering decoder sees it, is
+// primed from the GOP cache and comes at once instead of at the next
+// keyframe. Cached frames before the resume are not delivered.
+static void test_gop_resume() {
+	gang_decoder *dec    = new_clip_decoder();
+	Run           r      = {0};
+	int           before = 0;
+	int           ret;
+
+	set_gang_decoder_gop_cache(dec, 300);
+	EXPECT(open_clip_decoder(dec, 1, 1) == 0);
+
+	do {
+		// Taken for 0.4s, left until 1.4s, between the keyframes at 1.2s
+		// and 1.6s.
+		dec->video_by_ref = (r.audio < CLIP_BLOCKS / 5) || (r.audio >= CLIP_BLOCKS * 7 / 10);
+
+		if (r.audio < CLIP_BLOCKS * 7 / 10) before = r.video;
+		ret = step(dec, &r);
+	} while ((ret != GANG_FITAL) && (r.steps < MAX_STEPS));
+
+	// 0.6s left at 25 fps, 10 frames from the next keyframe.
+	EXPECT(r.video - before >= 13);
+	EXPECT(r.video - before <= 16);
+	EXPECT(r.backwards == 0);
+	free_clip_decoder(dec);
+}
+
+// Frames a threaded decoder still holds at the end of the input come out
+// before the end, with the input read inline or on the reader thread.
+static void test_drain() {
+	gang_decoder *dec = new_clip_decoder();
+	Run           r   = {0};
+	Run           queued = {0};
+
+	set_gang_decoder_threads(dec, 2, 1);
+	EXPECT(open_clip_decoder(dec, 1, 1) == 0);
+
+	run(dec, &r);
+	EXPECT(r.video == CLIP_FRAMES);
+	EXPECT(r.backwards == 0);
+	EXPECT(r.audio == CLIP_BLOCKS);
+	free_clip_decoder(dec);
+
+	dec = new_clip_decoder();
+	set_gang_decoder_threads(dec, 2, 1);
+	set_gang_decoder_pkt_queue(dec, 16, PKT_QUEUE_BLOCK);
+	EXPECT(open_clip_decoder(dec, 1, 1) == 0);
+
+	run(dec, &queued);
+	EXPECT(queued.video == CLIP_FRAMES);
+	EXPECT(queued.audio == CLIP_BLOCKS);
+	free_clip_decoder(dec);
+}
+
+int main() {
+	initialize_gang_decoder_globel();
+
+	if (write_clip() < 0) {
+		printf("could not write %s\n", clip);
+		unlink(clip);
+		return 1;
+	}
+	test_renditions();
+	test_video_format();
+	test_skip();
+	test_key_only();
+	test_selective();
+	test_gop_resume();
+	test_drain();
+
+	unlink(clip);
+	return test_result();
+}
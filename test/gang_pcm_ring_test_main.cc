@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+#include "../gang_pcm_ring.h"
+#include "gang_test.h"
+
+using namespace gang;
+
+static void fill(uint8_t *data, size_t len, uint8_t first) {
+	for (size_t i = 0; i < len; i++) data[i] = first + i;
+}
+
+static bool filled(const uint8_t *data, size_t len, uint8_t first) {
+	for (size_t i = 0; i < len; i++) {
+		if (data[i] != (uint8_t)(first + i)) return false;
+	}
+	return true;
+}
+
+// Writes and reads are all or nothing.
+static void test_overrun_and_underrun() {
+	PcmRing ring(16);
+	uint8_t in[16], out[16];
+
+	fill(in, 16, 0);
+	EXPECT(ring.Size() == 0);
+	EXPECT(!ring.Read(out, 1));
+
+	EXPECT(ring.Write(in, 10));
+	EXPECT(!ring.Write(in, 7));
+	EXPECT(ring.Size() == 10);
+	EXPECT(ring.Write(in + 10, 6));
+	EXPECT(ring.Size() == 16);
+	EXPECT(!ring.Write(in, 1));
+
+	EXPECT(!ring.Read(out, 17));
+	EXPECT(ring.Size() == 16);
+	EXPECT(ring.Read(out, 16));
+	EXPECT(filled(out, 16, 0));
+	EXPECT(ring.Size() == 0);
+	EXPECT(!ring.Read(out, 1));
+}
+
+// Blocks that straddle the end of the buffer come out whole.
+static void test_wraparound() {
+	PcmRing ring(16);
+	uint8_t in[16], out[16];
+	uint8_t next = 0;
+
+	for (int round = 0; round < 100; round++) {
+		size_t len = 1 + round % 11;
+
+		fill(in, len, next);
+		EXPECT(ring.Write(in, len));
+		EXPECT(ring.Read(out, len));
+		EXPECT(filled(out, len, next));
+		next += len;
+	}
+	EXPECT(ring.Size() == 0);
+}
+
+static void test_skip() {
+	PcmRing ring(16);
+	uint8_t in[16], out[16];
+
+	fill(in, 12, 0);
+	EXPECT(ring.Write(in, 12));
+	ring.Skip(4);
+	EXPECT(ring.Size() == 8);
+	EXPECT(ring.Read(out, 2));
+	EXPECT(filled(out, 2, 4));
+
+	// No more than what is buffered.
+	ring.Skip(100);
+	EXPECT(ring.Size() == 0);
+	EXPECT(ring.Write(in, 16));
+	EXPECT(ring.Size() == 16);
+}
+
+// One producer and one consumer thread, every byte arrives in order.
+static void test_threads() {
+	const size_t total = 1 << 22;
+	PcmRing      ring(4096);
+	bool         ok = true;
+
+	std::thread producer([&ring, total] {
+		uint8_t block[480];
+		size_t  sent = 0;
+
+		while (sent < total) {
+			fill(block, sizeof(block), (uint8_t)sent);
+
+			if (ring.Write(block, sizeof(block))) sent += sizeof(block);
+			else std::this_thread::yield();
+		}
+	});
+	uint8_t block[480];
+	size_t  got = 0;
+
+	while (got < total) {
+		if (!ring.Read(block, sizeof(block))) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		if (!filled(block, sizeof(block), (uint8_t)got)) ok = false;
+		got += sizeof(block);
+	}
+	producer.join();
+	EXPECT(ok);
+}
+
+int main() {
+	test_overrun_and_underrun();
+	test_wraparound();
+	test_skip();
+	test_threads();
+
+	return test_result();
+}
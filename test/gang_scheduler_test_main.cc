@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "../gang_scheduler.h"
+#include "gang_test.h"
+
+using namespace gang;
+
+// Records how its messages ran.
+class Recorder : public rtc::MessageHandler {
+public:
+	Recorder() : inside(0), overlaps(0), handled(0), sleep_ms(0) {}
+
+	virtual void OnMessage(rtc::Message *msg) {
+		if (inside.fetch_add(1)) overlaps++;
+
+		if (!strand->IsCurrent()) overlaps++;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			ids.push_back(msg->message_id);
+			threads.insert(std::this_thread::get_id());
+		}
+
+		if (sleep_ms) std::this_thread::sleep_for(std::chrono::milliseconds(sleep_ms));
+
+		if (msg->message_id == kOffload) {
+			strand->Offload([this] {
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			}, kDone);
+		}
+		inside--;
+		handled++;
+	}
+
+	enum {kOffload = 1000000, kDone};
+
+	std::shared_ptr<GangStrand> strand;
+	std::atomic<int>            inside;
+	std::atomic<int>            overlaps;
+	std::atomic<int>            handled;
+	int                         sleep_ms;
+	std::mutex                  mutex;
+	std::vector<uint32>         ids;
+	std::set<std::thread::id>   threads;
+};
+
+static void wait_handled(Recorder *r, int n) {
+	for (int i = 0; i < 5000 && r->handled < n; i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+// Posts from many threads, one handler call at a time and each thread's
+// posts in order.
+static void test_strand_serialization() {
+	const int     kThreads = 4;
+	const int     kPosts   = 2000;
+	GangScheduler scheduler(4);
+	Recorder      r;
+
+	r.strand = scheduler.CreateStrand(&r);
+
+	std::vector<std::thread> posters;
+
+	for (int t = 0; t < kThreads; t++) {
+		posters.push_back(std::thread([&r, t] {
+			for (int i = 0; i < kPosts; i++) r.strand->Post(t * kPosts + i);
+		}));
+	}
+
+	for (auto& poster : posters) poster.join();
+	wait_handled(&r, kThreads * kPosts);
+	r.strand->Stop();
+
+	EXPECT(r.handled == kThreads * kPosts);
+	EXPECT(r.overlaps == 0);
+
+	int last[kThreads] = {-1, -1, -1, -1};
+
+	for (uint32 id : r.ids) {
+		int t = id / kPosts;
+
+		EXPECT((int)id > last[t]);
+		last[t] = id;
+	}
+}
+
+// Strands woken from one worker land in its queue, idle workers steal them.
+static void test_stealing() {
+	const int             kStrands = 8;
+	GangScheduler         scheduler(4);
+	Recorder              starter;
+	std::vector<Recorder> busy(kStrands);
+
+	for (auto& r : busy) {
+		r.strand   = scheduler.CreateStrand(&r);
+		r.sleep_ms = 100;
+	}
+
+	class Starter : public rtc::MessageHandler {
+	public:
+		explicit Starter(std::vector<Recorder> *busy) : busy_(busy) {}
+
+		virtual void OnMessage(rtc::Message *) {
+			for (auto& r : *busy_) r.strand->Post(0);
+		}
+
+	private:
+		std::vector<Recorder> *busy_;
+	} handler(&busy);
+
+	std::shared_ptr<GangStrand> start = scheduler.CreateStrand(&handler);
+
+	start->Post(0);
+
+	for (auto& r : busy) wait_handled(&r, 1);
+
+	std::set<std::thread::id> threads;
+
+	for (auto& r : busy) {
+		threads.insert(r.threads.begin(), r.threads.end());
+		r.strand->Stop();
+	}
+	start->Stop();
+	EXPECT(threads.size() > 1);
+}
+
+// Nothing else runs while offloaded, the done message comes first.
+static void test_offload() {
+	GangScheduler scheduler(2);
+	Recorder      r;
+
+	r.strand = scheduler.CreateStrand(&r);
+	r.strand->Post(Recorder::kOffload);
+	r.strand->Post(1);
+	r.strand->Post(2);
+	wait_handled(&r, 4);
+	r.strand->Stop();
+
+	EXPECT(r.overlaps == 0);
+	EXPECT(r.ids.size() == 4);
+	EXPECT((r.ids.size() == 4) && (r.ids[0] == Recorder::kOffload) && (r.ids[1] == Recorder::kDone) &&
+	       (r.ids[2] == 1) && (r.ids[3] == 2));
+
+	// Stop waits for the task and still delivers done.
+	Recorder s;
+
+	s.strand = scheduler.CreateStrand(&s);
+	s.strand->Post(Recorder::kOffload);
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	s.strand->Stop();
+	EXPECT((s.ids.size() == 2) && (s.ids[1] == Recorder::kDone));
+}
+
+static void test_delayed() {
+	GangScheduler scheduler(2);
+	Recorder      r;
+
+	r.strand = scheduler.CreateStrand(&r);
+	r.strand->PostDelayed(50, 2);
+	r.strand->Post(1);
+	wait_handled(&r, 2);
+	r.strand->Stop();
+	EXPECT((r.ids.size() == 2) && (r.ids[0] == 1) && (r.ids[1] == 2));
+}
+
+int main() {
+	test_strand_serialization();
+	test_stealing();
+	test_offload();
+	test_delayed();
+
+	return test_result();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdio.h>
+
+// Checks of the *_test_main unit tests. A failed EXPECT is printed and
+// counted, the test goes on and main returns test_result().
+
+static int failures = 0;
+
+#define EXPECT(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+static int test_result(void) {
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}